@@ -0,0 +1,437 @@
+/*
+ * AIME Reader Protocol Server
+ * WHowe <github.com/whowechina>
+ *
+ * Serves the AIME card reader (and its LED board) protocol on CDC 2, backed
+ * by the background card tracker. Card data is served from its cache, and
+ * what has to go to the PN532 is done one step per aime_update(), so the
+ * input loop keeps running while a command is served.
+ */
+
+#include "aime.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "card.h"
+#include "pn532.h"
+
+#define AIME_CDC 2
+
+#define AIME_SYNC 0xe0
+#define AIME_ESCAPE 0xd0
+
+#define AIME_BUSY -1
+
+enum {
+    CMD_GET_FW_VERSION = 0x30,
+    CMD_GET_HW_VERSION = 0x32,
+    CMD_START_POLLING = 0x40,
+    CMD_STOP_POLLING = 0x41,
+    CMD_CARD_DETECT = 0x42,
+    CMD_CARD_SELECT = 0x43,
+    CMD_CARD_HALT = 0x44,
+    CMD_MIFARE_KEY_SET_A = 0x50,
+    CMD_MIFARE_AUTHORIZE_A = 0x51,
+    CMD_MIFARE_READ = 0x52,
+    CMD_MIFARE_KEY_SET_B = 0x54,
+    CMD_MIFARE_AUTHORIZE_B = 0x55,
+    CMD_TO_UPDATER_MODE = 0x60,
+    CMD_SEND_HEX_DATA = 0x61,
+    CMD_TO_NORMAL_MODE = 0x62,
+    CMD_SEND_BINDATA_INIT = 0x63,
+    CMD_SEND_BINDATA_EXEC = 0x64,
+    CMD_FELICA_THROUGH = 0x71,
+    CMD_EXT_BOARD_LED = 0x80,
+    CMD_EXT_BOARD_LED_RGB = 0x81,
+    CMD_EXT_BOARD_LED_RGB_UNKNOWN = 0x82,
+    CMD_EXT_BOARD_INFO = 0xf0,
+    CMD_EXT_FIRM_SUM = 0xf2,
+    CMD_EXT_SEND_HEX_DATA = 0xf3,
+    CMD_EXT_TO_BOOT_MODE = 0xf4,
+    CMD_EXT_TO_NORMAL_MODE = 0xf5,
+};
+
+enum {
+    STATUS_OK = 0,
+    STATUS_CARD_ERROR = 1,
+    STATUS_NOT_ACCEPT = 2,
+    STATUS_INVALID_COMMAND = 3,
+    STATUS_INVALID_DATA = 4,
+    STATUS_SUM_ERROR = 5,
+    STATUS_INTERNAL_ERROR = 6,
+    STATUS_INVALID_FIRM_DATA = 16,
+    STATUS_FIRM_UPDATE_SUCCESS = 32,
+};
+
+enum {
+    AIME_CARD_MIFARE = 0x10,
+    AIME_CARD_FELICA = 0x20,
+};
+
+#define FELICA_CMD_NDA_A4 0xa4
+
+static const char *fw_version = "TN32MSEC003S F/W Ver1.2";
+static const char *hw_version = "TN32MSEC003S H/W Ver3.0";
+static const char *led_info = "15084\xff\x10\x00\x12";
+
+static union __attribute__((packed)) {
+    struct {
+        uint8_t len;
+        uint8_t addr;
+        uint8_t seq;
+        uint8_t cmd;
+        uint8_t payload_len;
+        uint8_t payload[251];
+    };
+    uint8_t raw[256];
+} request;
+
+static union __attribute__((packed)) {
+    struct {
+        uint8_t len;
+        uint8_t addr;
+        uint8_t seq;
+        uint8_t cmd;
+        uint8_t status;
+        uint8_t payload_len;
+        uint8_t payload[250];
+    };
+    uint8_t raw[256];
+} response;
+
+static struct {
+    int len;
+    bool active;
+    bool escaping;
+} rx;
+
+static struct {
+    uint8_t buf[520];
+    int len;
+    int pos;
+} tx;
+
+static struct {
+    bool running;
+} job;
+
+static struct {
+    uint8_t key_a[6];
+    uint8_t key_b[6];
+} reader;
+
+void aime_init()
+{
+    card_init();
+}
+
+static inline int put_escaped(int pos, uint8_t c)
+{
+    if ((c == AIME_SYNC) || (c == AIME_ESCAPE)) {
+        tx.buf[pos++] = AIME_ESCAPE;
+        c--;
+    }
+    tx.buf[pos++] = c;
+    return pos;
+}
+
+static void send_response()
+{
+    response.len = 6 + response.payload_len;
+
+    int pos = 0;
+    tx.buf[pos++] = AIME_SYNC;
+    uint8_t checksum = 0;
+    for (int i = 0; i < response.len; i++) {
+        pos = put_escaped(pos, response.raw[i]);
+        checksum += response.raw[i];
+    }
+    pos = put_escaped(pos, checksum);
+
+    tx.len = pos;
+    tx.pos = 0;
+}
+
+static void tx_run()
+{
+    if (tx.pos >= tx.len) {
+        return;
+    }
+    tx.pos += tud_cdc_n_write(AIME_CDC, tx.buf + tx.pos, tx.len - tx.pos);
+    tud_cdc_n_write_flush(AIME_CDC);
+}
+
+static int reply_data(const void *data, uint8_t len)
+{
+    memcpy(response.payload, data, len);
+    response.payload_len = len;
+    return STATUS_OK;
+}
+
+static int cmd_card_detect()
+{
+    const card_t *card = card_current();
+
+    uint8_t *p = response.payload;
+    if (card && (card->type == CARD_MIFARE)) {
+        *p++ = 1;
+        *p++ = AIME_CARD_MIFARE;
+        *p++ = card->uid_len;
+        memcpy(p, card->uid, card->uid_len);
+        p += card->uid_len;
+    } else if (card && (card->type == CARD_FELICA)) {
+        *p++ = 1;
+        *p++ = AIME_CARD_FELICA;
+        *p++ = 16;
+        memcpy(p, card->uid, 8);
+        memcpy(p + 8, card->pmm, 8);
+        p += 16;
+    } else {
+        *p++ = 0;
+    }
+    response.payload_len = p - response.payload;
+    return STATUS_OK;
+}
+
+static int cmd_rf_field(bool on)
+{
+    card_enable(on);
+    return STATUS_OK;
+}
+
+static int cmd_mifare_key(uint8_t *key)
+{
+    if (request.payload_len != 6) {
+        return STATUS_INVALID_DATA;
+    }
+    memcpy(key, request.payload, 6);
+    return STATUS_OK;
+}
+
+static int cmd_mifare_auth(uint8_t key_id, const uint8_t *key)
+{
+    if (request.payload_len < 5) {
+        return STATUS_CARD_ERROR;
+    }
+    int ret = card_mifare_auth_async(request.payload, request.payload[4],
+                                     key_id, key);
+    if (ret == PN532_BUSY) {
+        return AIME_BUSY;
+    }
+    return (ret == PN532_OK) ? STATUS_OK : STATUS_CARD_ERROR;
+}
+
+static int cmd_mifare_read()
+{
+    if (request.payload_len < 5) {
+        return STATUS_CARD_ERROR;
+    }
+    int ret = card_mifare_read_async(request.payload[4], response.payload);
+    if (ret == PN532_BUSY) {
+        return AIME_BUSY;
+    }
+    if (ret != PN532_OK) {
+        return STATUS_CARD_ERROR;
+    }
+    response.payload_len = 16;
+    return STATUS_OK;
+}
+
+/* request: idm[8], len, FeliCa frame (len, code, idm[8], params) */
+static int cmd_felica_through()
+{
+    const uint8_t *frame = request.payload + 9;
+    uint8_t frame_len = request.payload[8];
+
+    if ((request.payload_len < 9 + 10) || (frame_len < 10) ||
+        (frame_len + 9 > request.payload_len) || (frame[0] != frame_len)) {
+        return STATUS_CARD_ERROR;
+    }
+
+    if (frame[1] == FELICA_CMD_NDA_A4) {
+        uint8_t *p = response.payload;
+        *p++ = 11;
+        *p++ = FELICA_CMD_NDA_A4 + 1;
+        memcpy(p, frame + 2, 8);
+        p[8] = 0;
+        response.payload_len = 11;
+        return STATUS_OK;
+    }
+
+    int ret = card_felica_through_async(frame, response.payload,
+                                        sizeof(response.payload));
+    if (ret == PN532_BUSY) {
+        return AIME_BUSY;
+    }
+    if (ret < 0) {
+        return STATUS_CARD_ERROR;
+    }
+    response.payload_len = ret;
+    return STATUS_OK;
+}
+
+static int handle_request()
+{
+    switch (request.cmd) {
+        case CMD_GET_FW_VERSION:
+            return reply_data(fw_version, strlen(fw_version));
+        case CMD_GET_HW_VERSION:
+            return reply_data(hw_version, strlen(hw_version));
+        case CMD_START_POLLING:
+            return cmd_rf_field(true);
+        case CMD_STOP_POLLING:
+            return cmd_rf_field(false);
+        case CMD_CARD_DETECT:
+            return cmd_card_detect();
+        case CMD_CARD_SELECT:
+        case CMD_CARD_HALT:
+            return STATUS_OK;
+        case CMD_MIFARE_KEY_SET_A:
+            return cmd_mifare_key(reader.key_a);
+        case CMD_MIFARE_KEY_SET_B:
+            return cmd_mifare_key(reader.key_b);
+        case CMD_MIFARE_AUTHORIZE_A:
+            return cmd_mifare_auth(0, reader.key_a);
+        case CMD_MIFARE_AUTHORIZE_B:
+            return cmd_mifare_auth(1, reader.key_b);
+        case CMD_MIFARE_READ:
+            return cmd_mifare_read();
+        case CMD_FELICA_THROUGH:
+            return cmd_felica_through();
+        case CMD_TO_NORMAL_MODE:
+            return STATUS_INVALID_COMMAND;
+        case CMD_SEND_HEX_DATA:
+        case CMD_EXT_SEND_HEX_DATA:
+            return STATUS_FIRM_UPDATE_SUCCESS;
+        case CMD_TO_UPDATER_MODE:
+        case CMD_SEND_BINDATA_INIT:
+        case CMD_SEND_BINDATA_EXEC:
+        case CMD_EXT_FIRM_SUM:
+        case CMD_EXT_TO_BOOT_MODE:
+            return STATUS_OK;
+        case CMD_EXT_BOARD_INFO:
+            return reply_data(led_info, 9);
+        case CMD_EXT_TO_NORMAL_MODE:
+            response.payload[0] = 0;
+            response.payload_len = 1;
+            return STATUS_OK;
+        default:
+            return STATUS_INVALID_COMMAND;
+    }
+}
+
+static bool needs_no_reply(uint8_t cmd)
+{
+    return (cmd == CMD_EXT_BOARD_LED) ||
+           (cmd == CMD_EXT_BOARD_LED_RGB) ||
+           (cmd == CMD_EXT_BOARD_LED_RGB_UNKNOWN);
+}
+
+static void start_request()
+{
+    response.addr = request.addr;
+    response.seq = request.seq;
+    response.cmd = request.cmd;
+    response.status = STATUS_OK;
+    response.payload_len = 0;
+
+    if (needs_no_reply(request.cmd)) {
+        return;
+    }
+
+    job.running = true;
+    card_hold(true);
+}
+
+static void run_job()
+{
+    if (!job.running) {
+        return;
+    }
+
+    int status = handle_request();
+    if (status == AIME_BUSY) {
+        return;
+    }
+
+    job.running = false;
+    card_hold(false);
+    response.status = status;
+    send_response();
+}
+
+/* true when a complete request is in the buffer */
+static bool rx_byte(uint8_t c)
+{
+    if (c == AIME_SYNC) {
+        rx.active = true;
+        rx.escaping = false;
+        rx.len = 0;
+        return false;
+    }
+
+    if (!rx.active) {
+        return false;
+    }
+
+    if (c == AIME_ESCAPE) {
+        rx.escaping = true;
+        return false;
+    }
+
+    if (rx.escaping) {
+        rx.escaping = false;
+        c++;
+    }
+
+    request.raw[rx.len++] = c;
+
+    if ((rx.len < 1) || (rx.len < request.len + 1)) {
+        return false; // frame_len bytes plus checksum
+    }
+
+    rx.active = false;
+
+    uint8_t checksum = 0;
+    for (int i = 0; i < request.len; i++) {
+        checksum += request.raw[i];
+    }
+    if (checksum != request.raw[request.len]) {
+        response.addr = request.addr;
+        response.seq = request.seq;
+        response.cmd = request.cmd;
+        response.status = STATUS_SUM_ERROR;
+        response.payload_len = 0;
+        send_response();
+        return false;
+    }
+
+    return true;
+}
+
+static void rx_run()
+{
+    /* one request at a time, the host waits for each response anyway */
+    while (!job.running && (tx.pos >= tx.len) &&
+           tud_cdc_n_available(AIME_CDC)) {
+        uint8_t c;
+        if (tud_cdc_n_read(AIME_CDC, &c, 1) != 1) {
+            break;
+        }
+        if (rx_byte(c)) {
+            start_request();
+        }
+    }
+}
+
+void aime_update()
+{
+    card_update();
+    rx_run();
+    run_job();
+    tx_run();
+}
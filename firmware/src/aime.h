@@ -0,0 +1,15 @@
+/*
+ * AIME Reader Protocol Server
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef AIME_H
+#define AIME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+void aime_init();
+void aime_update();
+
+#endif
@@ -19,11 +19,14 @@
 #include "gp2y0e.h"
 #include "vl53l0x.h"
 #include "i2c_hub.h"
+#include "trace.h"
 
 static const uint8_t TOF_LIST[] = TOF_MUX_LIST;
 static uint8_t tof_model[sizeof(TOF_LIST)];
 static uint16_t distances[sizeof(TOF_LIST) + 1]; // last one is always invalid
 
+uint32_t gp2y0e_errors;
+
 void air_init()
 {
     i2c_init(I2C_PORT, I2C_FREQ);
@@ -55,6 +58,11 @@ void air_init()
     }
 }
 
+uint32_t air_i2c_errors()
+{
+    return vl53l0x_errors() + gp2y0e_errors;
+}
+
 size_t air_num()
 {
     return sizeof(TOF_LIST);
@@ -120,6 +128,7 @@ unsigned air_value(uint8_t index)
 
 void air_update()
 {
+    TRACE_BEGIN(TRACE_AIR, 0);
     for (int i = 0; i < sizeof(TOF_LIST); i++) {
         i2c_select(I2C_PORT, 1 << TOF_LIST[i]);
         if (tof_model[i] == 1) {
@@ -128,6 +137,7 @@ void air_update()
             distances[i] = gp2y0e_dist_mm(I2C_PORT) * 10;
         }
     }
+    TRACE_END(TRACE_AIR, 0);
 }
 
 uint16_t air_raw(uint8_t index)
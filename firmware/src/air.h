@@ -15,5 +15,6 @@ unsigned air_value(uint8_t index);
 uint16_t air_raw(uint8_t index);
 uint8_t air_bitmap();
 void air_update();
+uint32_t air_i2c_errors();
 
 #endif
@@ -0,0 +1,454 @@
+/*
+ * Batch Config Commands in JSON Lines
+ * WHowe <github.com/whowechina>
+ *
+ * Just enough JSON for get/set batches: objects, arrays, strings without
+ * escapes and integers. Unknown keys are skipped.
+ */
+
+#include "batch.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "config.h"
+#include "slider.h"
+
+#define MAX_OPS 48
+#define MAX_VALUES 32
+#define NAME_LEN 24
+
+enum {
+    FIELD_U8,
+    FIELD_I8,
+    FIELD_U16,
+    FIELD_U32,
+    FIELD_NIBBLE_LO, // hid.joy and hid.nkro are 4 bit fields
+    FIELD_NIBBLE_HI,
+};
+
+typedef struct {
+    const char *name;
+    uint16_t offset;
+    uint8_t type;
+    uint8_t count; // array fields take and give JSON arrays
+} field_t;
+
+#define FIELD(name, member, type) \
+    { name, offsetof(chu_cfg_t, member), type, 1 }
+#define FIELD_ARRAY(name, member, type) \
+    { name, offsetof(chu_cfg_t, member), type, \
+      sizeof(((chu_cfg_t *)0)->member) / sizeof(((chu_cfg_t *)0)->member[0]) }
+
+static const field_t fields[] = {
+    FIELD("colors.key_on_upper", colors.key_on_upper, FIELD_U32),
+    FIELD("colors.key_on_lower", colors.key_on_lower, FIELD_U32),
+    FIELD("colors.key_on_both", colors.key_on_both, FIELD_U32),
+    FIELD("colors.key_off", colors.key_off, FIELD_U32),
+    FIELD("colors.gap", colors.gap, FIELD_U32),
+    FIELD("style.key", style.key, FIELD_U8),
+    FIELD("style.gap", style.gap, FIELD_U8),
+    FIELD("style.tof", style.tof, FIELD_U8),
+    FIELD("style.level", style.level, FIELD_U8),
+    FIELD("tof.offset", tof.offset, FIELD_U8),
+    FIELD("tof.pitch", tof.pitch, FIELD_U8),
+    FIELD("sense.filter", sense.filter, FIELD_I8),
+    FIELD("sense.global", sense.global, FIELD_I8),
+    FIELD("sense.debounce_touch", sense.debounce_touch, FIELD_U8),
+    FIELD("sense.debounce_release", sense.debounce_release, FIELD_U8),
+    FIELD_ARRAY("sense.keys", sense.keys, FIELD_I8),
+    { "hid.joy", offsetof(chu_cfg_t, hid), FIELD_NIBBLE_LO, 1 },
+    { "hid.nkro", offsetof(chu_cfg_t, hid), FIELD_NIBBLE_HI, 1 },
+    FIELD("slider.baud", slider.baud, FIELD_U32),
+    FIELD("slider.flow", slider.flow, FIELD_U8),
+    FIELD("nfc.poll_ms", nfc.poll_ms, FIELD_U16),
+    FIELD("nfc.ttl_ms", nfc.ttl_ms, FIELD_U16),
+    FIELD("led.fps", led.fps, FIELD_U16),
+    FIELD("led.gamma", led.gamma, FIELD_U8),
+    FIELD_ARRAY("led.white", led.white, FIELD_U8),
+    FIELD("led.dither", led.dither, FIELD_U8),
+};
+
+static const field_t *find_field(const char *name)
+{
+    for (int i = 0; i < count_of(fields); i++) {
+        if (strcmp(fields[i].name, name) == 0) {
+            return &fields[i];
+        }
+    }
+    return NULL;
+}
+
+static const uint8_t field_size[] = { 1, 1, 2, 4, 1, 1 };
+
+static int64_t field_get(const chu_cfg_t *cfg, const field_t *f, int index)
+{
+    const uint8_t *p = (const uint8_t *)cfg + f->offset + index * field_size[f->type];
+    switch (f->type) {
+        case FIELD_I8:
+            return (int8_t)p[0];
+        case FIELD_U16:
+            return p[0] | (p[1] << 8);
+        case FIELD_U32:
+            return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+        case FIELD_NIBBLE_LO:
+            return p[0] & 0x0f;
+        case FIELD_NIBBLE_HI:
+            return p[0] >> 4;
+        default:
+            return p[0];
+    }
+}
+
+static bool field_set(chu_cfg_t *cfg, const field_t *f, int index, int64_t v)
+{
+    uint8_t *p = (uint8_t *)cfg + f->offset + index * field_size[f->type];
+    switch (f->type) {
+        case FIELD_I8:
+            if ((v < -128) || (v > 127)) {
+                return false;
+            }
+            p[0] = v;
+            return true;
+        case FIELD_U16:
+            if ((v < 0) || (v > 0xffff)) {
+                return false;
+            }
+            p[0] = v;
+            p[1] = v >> 8;
+            return true;
+        case FIELD_U32:
+            if ((v < 0) || (v > 0xffffffff)) {
+                return false;
+            }
+            p[0] = v;
+            p[1] = v >> 8;
+            p[2] = v >> 16;
+            p[3] = v >> 24;
+            return true;
+        case FIELD_NIBBLE_LO:
+        case FIELD_NIBBLE_HI:
+            if ((v < 0) || (v > 15)) {
+                return false;
+            }
+            if (f->type == FIELD_NIBBLE_LO) {
+                p[0] = (p[0] & 0xf0) | v;
+            } else {
+                p[0] = (p[0] & 0x0f) | (v << 4);
+            }
+            return true;
+        default:
+            if ((v < 0) || (v > 255)) {
+                return false;
+            }
+            p[0] = v;
+            return true;
+    }
+}
+
+/* the tiny JSON reader */
+static const char *js;
+
+static void skip_ws()
+{
+    while ((*js == ' ') || (*js == '\t') || (*js == '\r') || (*js == '\n')) {
+        js++;
+    }
+}
+
+static bool take(char c)
+{
+    skip_ws();
+    if (*js != c) {
+        return false;
+    }
+    js++;
+    return true;
+}
+
+static bool parse_string(char *out, int size)
+{
+    if (!take('"')) {
+        return false;
+    }
+    int len = 0;
+    while (*js && (*js != '"')) {
+        if ((*js == '\\') || (len >= size - 1)) {
+            return false;
+        }
+        out[len++] = *js++;
+    }
+    out[len] = '\0';
+    return take('"');
+}
+
+static bool parse_int(int64_t *v)
+{
+    skip_ws();
+    bool neg = (*js == '-');
+    if (neg) {
+        js++;
+    }
+    if ((*js < '0') || (*js > '9')) {
+        return false;
+    }
+    int64_t result = 0;
+    while ((*js >= '0') && (*js <= '9') && (result < 0x100000000ll)) {
+        result = result * 10 + (*js++ - '0');
+    }
+    *v = neg ? -result : result;
+    return true;
+}
+
+static bool skip_value()
+{
+    skip_ws();
+    if (*js == '"') {
+        char tmp[64];
+        return parse_string(tmp, sizeof(tmp));
+    }
+    if ((*js == '{') || (*js == '[')) {
+        char close = (*js == '{') ? '}' : ']';
+        js++;
+        if (take(close)) {
+            return true;
+        }
+        do {
+            if (close == '}') {
+                char key[32];
+                if (!parse_string(key, sizeof(key)) || !take(':')) {
+                    return false;
+                }
+            }
+            if (!skip_value()) {
+                return false;
+            }
+        } while (take(','));
+        return take(close);
+    }
+    if ((*js == '-') || ((*js >= '0') && (*js <= '9'))) {
+        int64_t v;
+        return parse_int(&v);
+    }
+    const char *words[] = { "true", "false", "null" };
+    for (int i = 0; i < 3; i++) {
+        int len = strlen(words[i]);
+        if (strncmp(js, words[i], len) == 0) {
+            js += len;
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct {
+    char name[NAME_LEN];
+    bool set;
+    bool array;
+    int num;
+    int64_t values[MAX_VALUES];
+} op_t;
+
+static bool parse_values(op_t *op)
+{
+    op->num = 0;
+    op->array = take('[');
+    if (!op->array) {
+        op->num = 1;
+        return parse_int(&op->values[0]);
+    }
+    if (take(']')) {
+        return true;
+    }
+    do {
+        if ((op->num >= MAX_VALUES) || !parse_int(&op->values[op->num])) {
+            return false;
+        }
+        op->num++;
+    } while (take(','));
+    return take(']');
+}
+
+static bool parse_op(op_t *op)
+{
+    bool named = false;
+    bool valued = false;
+
+    op->set = false;
+    if (!take('{')) {
+        return false;
+    }
+    if (take('}')) {
+        return false;
+    }
+    do {
+        char key[16];
+        if (!parse_string(key, sizeof(key)) || !take(':')) {
+            return false;
+        }
+        if ((strcmp(key, "get") == 0) || (strcmp(key, "set") == 0)) {
+            op->set = (key[0] == 's');
+            if (!parse_string(op->name, sizeof(op->name))) {
+                return false;
+            }
+            named = true;
+        } else if (strcmp(key, "value") == 0) {
+            if (!parse_values(op)) {
+                return false;
+            }
+            valued = true;
+        } else if (!skip_value()) {
+            return false;
+        }
+    } while (take(','));
+
+    return take('}') && named && (valued == op->set);
+}
+
+/* reply text, only printed once the whole batch is known */
+static char out[2048];
+static int out_len;
+
+static void __attribute__((format(printf, 1, 2))) emit(const char *fmt, ...)
+{
+    if (out_len >= sizeof(out)) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    out_len += vsnprintf(out + out_len, sizeof(out) - out_len, fmt, args);
+    va_end(args);
+}
+
+static void emit_field(const chu_cfg_t *cfg, const field_t *f)
+{
+    emit("%s{\"name\":\"%s\",\"value\":", out_len > 0 ? "," : "", f->name);
+    if (f->count > 1) {
+        emit("[");
+    }
+    for (int i = 0; i < f->count; i++) {
+        emit("%s%lld", i ? "," : "", (long long)field_get(cfg, f, i));
+    }
+    emit(f->count > 1 ? "]}" : "}");
+}
+
+static const char *run_op(chu_cfg_t *cfg, const op_t *op)
+{
+    const field_t *f = find_field(op->name);
+    if (!f) {
+        return "unknown field";
+    }
+    if (op->set) {
+        if ((op->array != (f->count > 1)) || (op->num != f->count)) {
+            return "wrong value count";
+        }
+        for (int i = 0; i < f->count; i++) {
+            if (!field_set(cfg, f, i, op->values[i])) {
+                return "value out of range";
+            }
+        }
+    }
+    emit_field(cfg, f);
+    return NULL;
+}
+
+static void reply_error(int64_t id, int op, const char *error)
+{
+    printf("{\"id\":%lld,\"ok\":false,\"op\":%d,\"error\":\"%s\"}\n",
+           (long long)id, op, error);
+}
+
+void batch_process(const char *line)
+{
+    static chu_cfg_t work;
+    static op_t op;
+
+    work = *chu_cfg;
+    out_len = 0;
+    js = line;
+
+    int64_t id = 0;
+    int ops = 0;
+    bool changed = false;
+    const char *error = NULL;
+
+    if (!take('{')) {
+        reply_error(id, -1, "bad json");
+        return;
+    }
+    if (!take('}')) {
+        do {
+            char key[16];
+            if (!parse_string(key, sizeof(key)) || !take(':')) {
+                error = "bad json";
+                break;
+            }
+            if (strcmp(key, "id") == 0) {
+                if (!parse_int(&id)) {
+                    error = "bad json";
+                    break;
+                }
+            } else if (strcmp(key, "ops") == 0) {
+                if (!take('[')) {
+                    error = "bad json";
+                    break;
+                }
+                if (take(']')) {
+                    continue;
+                }
+                do {
+                    if (ops >= MAX_OPS) {
+                        error = "too many ops";
+                    } else if (!parse_op(&op)) {
+                        error = "bad op";
+                    } else {
+                        error = run_op(&work, &op);
+                        changed |= op.set;
+                    }
+                    if (error) {
+                        break;
+                    }
+                    ops++;
+                } while (take(','));
+                if (!error && !take(']')) {
+                    error = "bad json";
+                }
+            } else if (!skip_value()) {
+                error = "bad json";
+            }
+        } while (!error && take(','));
+        if (!error && !take('}')) {
+            error = "bad json";
+        }
+    }
+
+    if (error) {
+        reply_error(id, ops, error);
+        return;
+    }
+    if (out_len >= sizeof(out)) {
+        reply_error(id, -1, "reply too long");
+        return;
+    }
+
+    if (changed) {
+        if (!config_check(&work)) {
+            reply_error(id, -1, "config out of range");
+            return;
+        }
+        bool slider = memcmp(&work.slider, &chu_cfg->slider, sizeof(work.slider)) != 0;
+        *chu_cfg = work;
+        if (slider) {
+            slider_config_changed();
+        }
+        config_changed();
+    }
+
+    printf("{\"id\":%lld,\"ok\":true,\"results\":[%s]}\n", (long long)id, out);
+}
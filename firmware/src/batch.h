@@ -0,0 +1,21 @@
+/*
+ * Batch Config Commands in JSON Lines
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+/* A CLI line starting with '{' is a batch request, one JSON object:
+ *   {"id":1,"ops":[{"get":"tof.offset"},{"set":"tof.pitch","value":20},
+ *                  {"set":"led.white","value":[255,240,220]}]}
+ * Ops run in order on a copy of the active profile. Only if all of them
+ * succeed and the result passes the config range checks is the copy
+ * applied, with a single config_changed(). The reply is one line:
+ *   {"id":1,"ok":true,"results":[{"name":"tof.offset","value":80},...]}
+ *   {"id":1,"ok":false,"op":2,"error":"unknown field"}
+ * The reply starts at the first '{' of its line, a prompt may precede it.
+ */
+void batch_process(const char *line);
+
+#endif
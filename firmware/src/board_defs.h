@@ -11,13 +11,24 @@
 #define I2C_FREQ 1367*1000
 
 #define TOF_MUX_LIST { 3, 4, 5, 2, 1, 0, 11, 12, 13, 10, 9, 8}
+#define NFC_MUX_CHN 5 // PN532 on IR1
 
 #define RGB_PIN 28
-#define RGB_ORDER GRB // or RGB
+#define RGB_STRIP_LEN 13
+/* LED chain in wiring order: { segment, first, count, color order, reverse }
+   This board only has the 13 air/ToF indicators on the chain. The key and
+   gap LEDs are on the slider itself and are lit over the slider protocol
+   (slider.c), so they have no segment here. */
+#define RGB_LAYOUT { \
+    { RGB_SEG_AIR, 0, 13, RGB_ORDER_GRB, false }, \
+}
 
 #define SLIDER_TX 0
 #define SLIDER_RX 1
 #define SLIDER_UART uart0
+/* Optional hardware flow control, uart0 CTS/RTS are on GPIO 2/3 or 18/19 */
+//#define SLIDER_CTS 18
+//#define SLIDER_RTS 19
 
 #define NKRO_KEYMAP "1aqz2swx3dec4frv5gtb6hyn7jum8ki90olp,."
 
@@ -0,0 +1,673 @@
+/*
+ * Background Card Tracker
+ * WHowe <github.com/whowechina>
+ *
+ * Keeps polling the PN532 in the background (MIFARE, FeliCa and ISO14443B in
+ * turn) and remembers the card in the field, together with the blocks the
+ * host read from the previous cards. Host requests are answered from RAM
+ * and only cache misses go to the card.
+ */
+
+#include "card.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "board_defs.h"
+#include "config.h"
+#include "i2c_hub.h"
+#include "pn532.h"
+
+#define HOT_NUM 8
+#define CACHE_NUM 16
+#define MIFARE_READ_AHEAD 3 // a small sector, keeps a miss short on 4K cards
+#define FELICA_READ_MAX PN532_FELICA_READ_MAX
+#define FELICA_PREFETCH_MAX 4 // what most cards take in one read
+
+typedef struct {
+    card_type_t type;
+    uint8_t key_id; // MIFARE
+    uint8_t key[6];
+    uint16_t svc; // FeliCa service code
+    uint16_t block; // MIFARE block or FeliCa 2-byte block list element
+} block_ref_t;
+
+typedef struct {
+    bool valid;
+    uint8_t sector;
+    uint8_t key_id;
+    uint8_t key[6];
+} mifare_auth_t;
+
+static bool ready;
+static bool enabled = true;
+static bool held;
+static bool rf_on;
+
+static card_t card;
+static uint64_t last_seen;
+static uint64_t next_poll;
+static card_type_t poll_type = CARD_MIFARE;
+static bool prefetch_pending;
+
+/* blocks the host read, prefetched when a new card shows up */
+static block_ref_t hot[HOT_NUM];
+static int hot_num;
+static int hot_next;
+
+static struct {
+    block_ref_t ref;
+    uint8_t data[16];
+} cache[CACHE_NUM];
+static int cache_num;
+static int cache_next;
+
+static mifare_auth_t session; // what the PN532 really authenticated
+static mifare_auth_t host_auth; // what the host thinks is authenticated
+
+static card_stats_t stats;
+
+enum {
+    OP_NONE = 0,
+    OP_POLL,
+    OP_PREFETCH,
+    OP_RF_OFF,
+};
+
+static struct {
+    int op;
+    card_type_t type;
+    int index;
+    uint8_t uid[10];
+    int uid_len;
+    uint8_t pmm[8];
+    uint8_t syscode[2];
+    uint64_t start;
+} bg;
+
+static uint8_t blocks[FELICA_READ_MAX * 16];
+
+/* PN532 owners, so a background job never consumes a host reply */
+enum {
+    OWNER_BG = 1,
+    OWNER_HOST,
+};
+
+static struct {
+    int step;
+    uint8_t param[256];
+    uint8_t param_len;
+} host;
+
+/* The PN532 sits behind the I2C hub, it's selected right before each PN532
+   step. Idle loops and cached answers stay off the bus. */
+static inline void nfc_select()
+{
+    i2c_select(I2C_PORT, 1 << NFC_MUX_CHN);
+}
+
+bool card_init()
+{
+    nfc_select();
+    ready = (pn532_firmware_ver() != 0) &&
+            pn532_config_sam() && pn532_config_rf();
+    return ready;
+}
+
+static inline uint8_t mifare_sector(uint8_t block)
+{
+    return block < 128 ? block / 4 : 32 + (block - 128) / 16;
+}
+
+/* from the block on to the last data block of its sector, no trailer */
+static inline uint8_t mifare_span(uint8_t block)
+{
+    uint8_t trailer = block < 128 ? (block | 0x03) : (block | 0x0f);
+    if (block >= trailer) {
+        return 1;
+    }
+    uint8_t num = trailer - block;
+    return num > MIFARE_READ_AHEAD ? MIFARE_READ_AHEAD : num;
+}
+
+static bool ref_match(const block_ref_t *a, const block_ref_t *b)
+{
+    if ((a->type != b->type) || (a->block != b->block)) {
+        return false;
+    }
+    return (a->type != CARD_FELICA) || (a->svc == b->svc);
+}
+
+static int cache_find(const block_ref_t *ref)
+{
+    for (int i = 0; i < cache_num; i++) {
+        if (ref_match(&cache[i].ref, ref)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void cache_store(const block_ref_t *ref, const uint8_t data[16])
+{
+    int i = cache_find(ref);
+    if (i < 0) {
+        if (cache_num < CACHE_NUM) {
+            i = cache_num++;
+        } else {
+            i = cache_next;
+            cache_next = (cache_next + 1) % CACHE_NUM;
+        }
+    }
+    cache[i].ref = *ref;
+    memcpy(cache[i].data, data, 16);
+}
+
+/* a block of the sector was read with this very key */
+static bool cache_has_sector(uint8_t sector, uint8_t key_id, const uint8_t key[6])
+{
+    for (int i = 0; i < cache_num; i++) {
+        const block_ref_t *ref = &cache[i].ref;
+        if ((ref->type == CARD_MIFARE) &&
+            (mifare_sector(ref->block) == sector) &&
+            (ref->key_id == key_id) && (memcmp(ref->key, key, 6) == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void hot_add(const block_ref_t *ref)
+{
+    for (int i = 0; i < hot_num; i++) {
+        if (ref_match(&hot[i], ref)) {
+            hot[i] = *ref;
+            return;
+        }
+    }
+    if (hot_num < HOT_NUM) {
+        hot[hot_num++] = *ref;
+    } else {
+        hot[hot_next] = *ref;
+        hot_next = (hot_next + 1) % HOT_NUM;
+    }
+}
+
+static void forget_card()
+{
+    card.type = CARD_NONE;
+    cache_num = 0;
+    cache_next = 0;
+    session.valid = false;
+    host_auth.valid = false;
+    prefetch_pending = false;
+}
+
+/* One auth (if not done yet) and then the following blocks, all cached */
+static int mifare_fetch(const block_ref_t *ref)
+{
+    uint8_t sector = mifare_sector(ref->block);
+    if (!session.valid || (session.sector != sector) ||
+        (session.key_id != ref->key_id) ||
+        (memcmp(session.key, ref->key, 6) != 0)) {
+        int ret = pn532_mifare_auth_async(card.uid, ref->block,
+                                          ref->key_id, ref->key);
+        if (ret == PN532_BUSY) {
+            return ret;
+        }
+        if (ret != PN532_OK) {
+            session.valid = false;
+            return PN532_FAIL;
+        }
+        session.valid = true;
+        session.sector = sector;
+        session.key_id = ref->key_id;
+        memcpy(session.key, ref->key, 6);
+        return PN532_BUSY; // read on the next call
+    }
+
+    uint8_t num = mifare_span(ref->block);
+    int ret = pn532_mifare_read_blocks_async(ref->block, num, blocks);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+
+    block_ref_t each = *ref;
+    for (int i = 0; i < num; i++) {
+        each.block = ref->block + i;
+        cache_store(&each, blocks + i * 16);
+    }
+    return PN532_OK;
+}
+
+/* uncached hot blocks of the same service, read in one go */
+static int felica_fetch(const block_ref_t *ref)
+{
+    uint16_t ids[FELICA_PREFETCH_MAX];
+    uint8_t num = 0;
+    for (int i = 0; (i < hot_num) && (num < FELICA_PREFETCH_MAX); i++) {
+        if ((hot[i].type == CARD_FELICA) && (hot[i].svc == ref->svc) &&
+            (cache_find(&hot[i]) < 0)) {
+            ids[num++] = hot[i].block;
+        }
+    }
+
+    int ret = pn532_felica_read_blocks_async(ref->svc, num, ids, blocks);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+
+    block_ref_t each = *ref;
+    for (int i = 0; i < num; i++) {
+        each.block = ids[i];
+        cache_store(&each, blocks + i * 16);
+    }
+    return PN532_OK;
+}
+
+static int poll_step()
+{
+    switch (bg.type) {
+        case CARD_MIFARE:
+            return pn532_poll_mifare_async(bg.uid, &bg.uid_len);
+        case CARD_14443B:
+            return pn532_poll_14443b_async(bg.uid, &bg.uid_len);
+        case CARD_FELICA:
+            bg.uid_len = 8;
+            return pn532_poll_felica_async(bg.uid, bg.pmm, bg.syscode, false);
+        default:
+            return PN532_FAIL;
+    }
+}
+
+static void poll_done(bool found)
+{
+    uint64_t now = time_us_64();
+
+    stats.polls++;
+    rf_on = true;
+    session.valid = false; // a new selection drops the MIFARE auth
+    next_poll = now + chu_cfg->nfc.poll_ms * 1000;
+
+    if (found) {
+        bool same = (card.type == bg.type) && (card.uid_len == bg.uid_len) &&
+                    (memcmp(card.uid, bg.uid, bg.uid_len) == 0);
+        if (!same) {
+            forget_card();
+            card.type = bg.type;
+            card.uid_len = bg.uid_len;
+            memcpy(card.uid, bg.uid, bg.uid_len);
+            memcpy(card.pmm, bg.pmm, 8);
+            memcpy(card.syscode, bg.syscode, 2);
+            card.since = bg.start;
+            prefetch_pending = true;
+            stats.arrivals++;
+        }
+        last_seen = now;
+        poll_type = bg.type;
+        return;
+    }
+
+    if (card.type != CARD_NONE) {
+        if (now - last_seen < chu_cfg->nfc.ttl_ms * 1000) {
+            return; // a missed poll or two doesn't mean it's gone
+        }
+        forget_card();
+        stats.removals++;
+    }
+
+    static const card_type_t next_type[] = {
+        [CARD_MIFARE] = CARD_FELICA,
+        [CARD_FELICA] = CARD_14443B,
+        [CARD_14443B] = CARD_MIFARE,
+    };
+    poll_type = next_type[poll_type];
+}
+
+static void prefetch_done()
+{
+    bg.op = OP_NONE;
+    if (card.type == CARD_NONE) {
+        return;
+    }
+    uint32_t ready = time_us_64() - card.since;
+    stats.ready_last = ready;
+    stats.ready_sum += ready;
+    stats.ready_cards++;
+    if (ready > stats.ready_max) {
+        stats.ready_max = ready;
+    }
+}
+
+static void prefetch_step()
+{
+    while ((bg.index < hot_num) &&
+           ((hot[bg.index].type != card.type) ||
+            (cache_find(&hot[bg.index]) >= 0))) {
+        bg.index++;
+    }
+
+    if ((card.type == CARD_NONE) || (bg.index >= hot_num)) {
+        prefetch_done();
+        return;
+    }
+
+    const block_ref_t *ref = &hot[bg.index];
+    int ret;
+    if (card.type == CARD_MIFARE) {
+        ret = mifare_fetch(ref);
+    } else {
+        ret = felica_fetch(ref);
+    }
+
+    if (ret == PN532_BUSY) {
+        return;
+    }
+    if (ret == PN532_OK) {
+        stats.prefetches++;
+    }
+    bg.index++;
+}
+
+static void bg_step()
+{
+    int ret;
+    nfc_select();
+    pn532_set_owner(OWNER_BG);
+    switch (bg.op) {
+        case OP_POLL:
+            ret = poll_step();
+            if (ret != PN532_BUSY) {
+                bg.op = OP_NONE;
+                poll_done(ret == PN532_OK);
+            }
+            break;
+        case OP_PREFETCH:
+            prefetch_step();
+            break;
+        case OP_RF_OFF:
+            ret = pn532_set_rf_field_async(0, 0);
+            if (ret != PN532_BUSY) {
+                bg.op = OP_NONE;
+                rf_on = false;
+            }
+            break;
+        default:
+            bg.op = OP_NONE;
+            break;
+    }
+}
+
+void card_update()
+{
+    if (!ready) {
+        return;
+    }
+
+    if (bg.op != OP_NONE) {
+        bg_step();
+        return;
+    }
+
+    if (held || pn532_busy()) {
+        return; // host command in flight
+    }
+
+    if (!enabled) {
+        if (rf_on) {
+            bg.op = OP_RF_OFF;
+        }
+        return;
+    }
+
+    if (prefetch_pending) {
+        prefetch_pending = false;
+        bg.op = OP_PREFETCH;
+        bg.index = 0;
+        return;
+    }
+
+    if (time_us_64() >= next_poll) {
+        bg.op = OP_POLL;
+        bg.start = time_us_64();
+        bg.type = poll_type;
+        bg.uid_len = sizeof(bg.uid);
+    }
+}
+
+void card_enable(bool on)
+{
+    if (on && !enabled) {
+        next_poll = 0;
+    }
+    if (!on) {
+        forget_card();
+    }
+    enabled = on;
+}
+
+void card_hold(bool hold)
+{
+    held = hold;
+}
+
+const card_t *card_current()
+{
+    return card.type == CARD_NONE ? NULL : &card;
+}
+
+/* let a running background job finish first */
+static bool reader_free()
+{
+    if (!ready) {
+        return false;
+    }
+    if (bg.op != OP_NONE) {
+        bg_step();
+    }
+    pn532_set_owner(OWNER_HOST);
+    return bg.op == OP_NONE;
+}
+
+int card_mifare_auth_async(const uint8_t uid[4], uint8_t block_id,
+                           uint8_t key_id, const uint8_t key[6])
+{
+    if (!ready) {
+        return PN532_FAIL;
+    }
+    if (!reader_free()) {
+        return PN532_BUSY;
+    }
+    if ((card.type != CARD_MIFARE) || (memcmp(uid, card.uid, 4) != 0)) {
+        return PN532_FAIL;
+    }
+
+    uint8_t sector = mifare_sector(block_id);
+    int ret = PN532_OK;
+    if (cache_has_sector(sector, key_id, key)) {
+        stats.hits++;
+    } else {
+        nfc_select();
+        ret = pn532_mifare_auth_async(card.uid, block_id, key_id, key);
+        if (ret == PN532_BUSY) {
+            return ret;
+        }
+        stats.misses++;
+        session.valid = (ret == PN532_OK);
+        session.sector = sector;
+        session.key_id = key_id;
+        memcpy(session.key, key, 6);
+    }
+
+    host_auth.valid = (ret == PN532_OK);
+    host_auth.sector = sector;
+    host_auth.key_id = key_id;
+    memcpy(host_auth.key, key, 6);
+
+    return ret;
+}
+
+int card_mifare_read_async(uint8_t block_id, uint8_t data[16])
+{
+    if (!reader_free()) {
+        return ready ? PN532_BUSY : PN532_FAIL;
+    }
+    if ((card.type != CARD_MIFARE) || !host_auth.valid ||
+        (mifare_sector(block_id) != host_auth.sector)) {
+        return PN532_FAIL;
+    }
+
+    block_ref_t ref = { .type = CARD_MIFARE, .key_id = host_auth.key_id,
+                        .block = block_id };
+    memcpy(ref.key, host_auth.key, 6);
+    hot_add(&ref);
+
+    int i = cache_find(&ref);
+    if (i >= 0) {
+        memcpy(data, cache[i].data, 16);
+        stats.hits++;
+        return PN532_OK;
+    }
+
+    nfc_select();
+    int ret = mifare_fetch(&ref);
+    if (ret == PN532_BUSY) {
+        return ret;
+    }
+    stats.misses++;
+    if (ret == PN532_OK) {
+        memcpy(data, blocks, 16);
+    }
+    return ret;
+}
+
+typedef struct {
+    uint16_t svc;
+    uint8_t num;
+    uint16_t blocks[FELICA_READ_MAX];
+} felica_read_t;
+
+/* Read Without Encryption, one service, 2-byte block list elements */
+static bool parse_felica_read(const uint8_t *frame, felica_read_t *req)
+{
+    if ((frame[0] < 14) || (frame[1] != 0x06) || (frame[10] != 1)) {
+        return false;
+    }
+    req->svc = frame[11] | (frame[12] << 8);
+    req->num = frame[13];
+    if ((req->num == 0) || (req->num > FELICA_READ_MAX) ||
+        (frame[0] != 14 + req->num * 2)) {
+        return false;
+    }
+    for (int i = 0; i < req->num; i++) {
+        const uint8_t *elem = frame + 14 + i * 2;
+        if ((elem[0] & 0x8f) != 0x80) {
+            return false;
+        }
+        req->blocks[i] = (elem[0] << 8) | elem[1];
+    }
+    return true;
+}
+
+static int felica_from_cache(const felica_read_t *req, uint8_t *resp,
+                             int resp_size)
+{
+    int len = 13 + req->num * 16;
+    if (len > resp_size) {
+        return -1;
+    }
+
+    for (int i = 0; i < req->num; i++) {
+        block_ref_t ref = { .type = CARD_FELICA, .svc = req->svc,
+                            .block = req->blocks[i] };
+        int slot = cache_find(&ref);
+        if (slot < 0) {
+            return -1;
+        }
+        memcpy(resp + 13 + i * 16, cache[slot].data, 16);
+    }
+
+    resp[0] = len;
+    resp[1] = 0x07;
+    memcpy(resp + 2, card.uid, 8);
+    resp[10] = 0;
+    resp[11] = 0;
+    resp[12] = req->num;
+    return len;
+}
+
+static void felica_to_cache(const felica_read_t *req, const uint8_t *resp,
+                            int len)
+{
+    if ((len != 13 + req->num * 16) || (resp[1] != 0x07) ||
+        (resp[10] != 0) || (resp[11] != 0) || (resp[12] != req->num)) {
+        return;
+    }
+    for (int i = 0; i < req->num; i++) {
+        block_ref_t ref = { .type = CARD_FELICA, .svc = req->svc,
+                            .block = req->blocks[i] };
+        cache_store(&ref, resp + 13 + i * 16);
+    }
+}
+
+int card_felica_through_async(const uint8_t *frame, uint8_t *resp, int resp_size)
+{
+    if (!reader_free()) {
+        return ready ? PN532_BUSY : PN532_FAIL;
+    }
+
+    felica_read_t req;
+    bool cacheable = (card.type == CARD_FELICA) &&
+                     (memcmp(frame + 2, card.uid, 8) == 0) &&
+                     parse_felica_read(frame, &req);
+
+    if (cacheable) {
+        for (int i = 0; i < req.num; i++) {
+            block_ref_t ref = { .type = CARD_FELICA, .svc = req.svc,
+                                .block = req.blocks[i] };
+            hot_add(&ref);
+        }
+        int len = felica_from_cache(&req, resp, resp_size);
+        if (len > 0) {
+            stats.hits++;
+            return len;
+        }
+    }
+
+    if (host.step == 0) {
+        host.param[0] = 1; // target 1, the one detected
+        memcpy(host.param + 1, frame, frame[0]);
+        host.param_len = frame[0] + 1;
+        host.step = 1;
+    }
+
+    uint8_t buf[256];
+    nfc_select();
+    int ret = pn532_command_async(0x40, host.param, host.param_len,
+                                  buf, sizeof(buf) - 1);
+    if (ret == PN532_BUSY) {
+        return ret;
+    }
+    host.step = 0;
+
+    if ((ret < 2) || ((buf[0] & 0x3f) != 0) || (buf[1] != ret - 1) ||
+        (buf[1] > resp_size)) {
+        return PN532_FAIL;
+    }
+
+    int len = buf[1];
+    memcpy(resp, buf + 1, len);
+    if (cacheable) {
+        stats.misses++;
+        felica_to_cache(&req, resp, len);
+    }
+    return len;
+}
+
+const card_stats_t *card_stats()
+{
+    return &stats;
+}
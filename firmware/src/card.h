@@ -0,0 +1,65 @@
+/*
+ * Background Card Tracker
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef CARD_H
+#define CARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    CARD_NONE = 0,
+    CARD_MIFARE,
+    CARD_FELICA,
+    CARD_14443B,
+} card_type_t;
+
+typedef struct {
+    card_type_t type;
+    uint8_t uid[10]; // FeliCa IDm is uid[0..7]
+    uint8_t uid_len;
+    uint8_t pmm[8];
+    uint8_t syscode[2];
+    uint64_t since; // us, when the card was first seen
+} card_t;
+
+typedef struct {
+    uint32_t polls;
+    uint32_t arrivals;
+    uint32_t removals;
+    uint32_t prefetches;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t ready_last; // us, from card in to its hot blocks cached
+    uint32_t ready_max;
+    uint32_t ready_sum;
+    uint32_t ready_cards;
+} card_stats_t;
+
+bool card_init(); // false if no PN532
+void card_update();
+
+/* Stop RF and polling when disabled, host "radio off" */
+void card_enable(bool on);
+
+/* Host owns the reader while held, no new background polls are started */
+void card_hold(bool hold);
+
+/* NULL when no card is present */
+const card_t *card_current();
+
+/* Same convention as pn532 *_async(): keep calling while PN532_BUSY,
+   cached data is returned without touching the PN532 */
+int card_mifare_auth_async(const uint8_t uid[4], uint8_t block_id,
+                           uint8_t key_id, const uint8_t key[6]);
+int card_mifare_read_async(uint8_t block_id, uint8_t data[16]);
+
+/* frame: FeliCa frame with the length byte, resp gets the reply frame,
+   returns the reply length */
+int card_felica_through_async(const uint8_t *frame, uint8_t *resp, int resp_size);
+
+const card_stats_t *card_stats();
+
+#endif
@@ -9,6 +9,7 @@
 #include "pico/bootrom.h"
 #include "cli.h"
 #include "save.h"
+#include "console.h"
 
 #define MAX_COMMANDS 32
 #define MAX_PARAMETERS 6
@@ -66,32 +67,10 @@ static void handle_help(int argc, char *argv[])
     }
 }
 
-static int fps[2];
-void cli_fps_count(int core)
-{
-    static uint32_t last[2] = {0};
-    static int counter[2] = {0};
-
-    counter[core]++;
-
-    uint32_t now = time_us_32();
-    if (now - last[core] < 1000000) {
-        return;
-    }
-    last[core] = now;
-    fps[core] = counter[core];
-    counter[core] = 0;
-}
-
-static void handle_fps(int argc, char *argv[])
-{
-    printf("FPS: core 0: %d, core 1: %d\n", fps[0], fps[1]);
-}
 static void handle_update(int argc, char *argv[])
 {
     printf("Boot into update mode.\n");
-    fflush(stdout);
-    sleep_ms(100);
+    console_flush(100000);
     reset_usb_boot(0, 2);
 }
 
@@ -110,7 +89,67 @@ int cli_extract_non_neg_int(const char *param, int len)
     return result;
 }
 
-static char cmd_buf[256];
+#define WATCH_BUDGET 50 // drawing and sending take at most 1/50 of core0 time
+#define WATCH_MIN_ROOM 2048 // skip frames the host isn't reading
+
+static struct {
+    cli_watch_t draw;
+    uint32_t interval_us;
+    uint64_t next;
+    uint32_t drain_us; // console drain time when the last frame was drawn
+} watch;
+
+void cli_watch(cli_watch_t draw, uint32_t interval_us)
+{
+    watch.draw = draw;
+    watch.interval_us = interval_us;
+    watch.next = 0;
+    watch.drain_us = console_stats()->drain_us;
+    printf("\033[2J");
+}
+
+static bool watch_run()
+{
+    if (!watch.draw) {
+        return false;
+    }
+
+    if (getchar_timeout_us(0) != EOF) {
+        watch.draw = NULL;
+        printf("\n%s", cli_prompt);
+        return true;
+    }
+
+    uint64_t now = time_us_64();
+    if (now < watch.next) {
+        return true;
+    }
+
+    uint32_t interval = watch.interval_us;
+    if (console_room() >= WATCH_MIN_ROOM) {
+        /* printf() only fills the ring, sending the last frame is the rest */
+        uint32_t drain_us = console_stats()->drain_us;
+        printf("\033[H\033[J");
+        watch.draw();
+        printf("\n(Any key to stop)");
+        uint32_t cost = time_us_64() - now + drain_us - watch.drain_us;
+        watch.drain_us = drain_us;
+        if (cost * WATCH_BUDGET > interval) {
+            interval = cost * WATCH_BUDGET;
+        }
+    }
+    watch.next = now + interval;
+    return true;
+}
+
+static cli_json_t json_handler;
+
+void cli_json(cli_json_t handler)
+{
+    json_handler = handler;
+}
+
+static char cmd_buf[1024]; // batch lines are long
 static int cmd_len = 0;
 
 static void process_cmd()
@@ -120,7 +159,7 @@ static void process_cmd()
 
     char *cmd = strtok(cmd_buf, " \n");
 
-    if (strlen(cmd) == 0) {
+    if (!cmd || (strlen(cmd) == 0)) {
         return;
     }
 
@@ -145,15 +184,24 @@ static void process_cmd()
 
 void cli_run()
 {
+    if (watch_run()) {
+        return;
+    }
+
     int c = getchar_timeout_us(0);
     if (c == EOF) {
         return;
     }
 
+    char lead = (cmd_len > 0) ? cmd_buf[0] : c;
+    bool json = json_handler && (lead == '{');
+
     if (c == '\b' || c == 127) { // both backspace and delete
         if (cmd_len > 0) {
             cmd_len--;
-            printf("\b \b");
+            if (!json) {
+                printf("\b \b");
+            }
         }
         return;
     }
@@ -162,7 +210,9 @@ void cli_run()
 
         if (cmd_len < sizeof(cmd_buf) - 2) {
             cmd_buf[cmd_len] = c;
-            printf("%c", c);
+            if (!json) {
+                printf("%c", c);
+            }
             cmd_len++;
         }
         return;
@@ -171,11 +221,18 @@ void cli_run()
     cmd_buf[cmd_len] = '\0';
     cmd_len = 0;
 
+    if (json) {
+        json_handler(cmd_buf);
+        return;
+    }
+
     printf("\n");
 
     process_cmd();
 
-    printf(cli_prompt);
+    if (!watch.draw) {
+        printf(cli_prompt);
+    }
 }
 
 void cli_init(const char *prompt, const char *logo)
@@ -188,6 +245,5 @@ void cli_init(const char *prompt, const char *logo)
     }
 
     cli_register("?", handle_help, "Display this help message.");
-    cli_register("fps", handle_fps, "Display FPS.");
     cli_register("update", handle_update, "Update firmware.");
 }
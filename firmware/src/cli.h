@@ -12,7 +12,14 @@ typedef void (*cmd_handler_t)(int argc, char *argv[]);
 void cli_init(const char *prompt, const char *logo);
 void cli_register(const char *cmd, cmd_handler_t handler, const char *help);
 void cli_run();
-void cli_fps_count(int core);
+
+/* Redraws in place every interval_us until a key is pressed */
+typedef void (*cli_watch_t)();
+void cli_watch(cli_watch_t draw, uint32_t interval_us);
+
+/* Lines starting with '{' go here instead, not echoed and no prompt */
+typedef void (*cli_json_t)(const char *line);
+void cli_json(cli_json_t handler);
 
 int cli_extract_non_neg_int(const char *param, int len);
 int cli_match_prefix(const char *str[], int num, const char *prefix);
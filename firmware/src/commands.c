@@ -13,10 +13,16 @@
 #include "air.h"
 #include "save.h"
 #include "cli.h"
-
-#include "i2c_hub.h"
-
+#include "slider.h"
+#include "rgb.h"
+#include "lights.h"
+
+#include "card.h"
+#include "console.h"
+#include "metrics.h"
+#include "button.h"
 #include "pn532.h"
+#include "batch.h"
 
 #define SENSE_LIMIT_MAX 9
 #define SENSE_LIMIT_MIN -9
@@ -74,9 +80,39 @@ static void disp_hid()
            chu_cfg->hid.nkro ? "on" : "off" );
 }
 
+static void disp_slider()
+{
+    printf("[Slider]\n");
+    if (chu_cfg->slider.baud) {
+        printf("  Baud: %lu", chu_cfg->slider.baud);
+    } else {
+        printf("  Baud: host (%lu)", slider_stats()->baud);
+    }
+    printf(", Flow control: %s\n", chu_cfg->slider.flow ? "on" : "off");
+}
+
+static void disp_led()
+{
+    printf("[LED]\n");
+    printf("  Frame rate: %d fps (now %lu fps)\n", chu_cfg->led.fps, rgb_fps());
+    printf("  Gamma: %s, Dither: %s, White balance: %d, %d, %d\n",
+           chu_cfg->led.gamma ? "on" : "off",
+           chu_cfg->led.dither ? "on" : "off", chu_cfg->led.white[0],
+           chu_cfg->led.white[1], chu_cfg->led.white[2]);
+    const rgb_host_stats_t *host = rgb_host_stats();
+    printf("  Host frames: %lu (%lu dropped), %lu fps\n",
+           host->frames, host->dropped, host->fps);
+}
+
+static void disp_nfc()
+{
+    printf("[NFC]\n");
+    printf("  Poll: %d ms, TTL: %d ms\n", chu_cfg->nfc.poll_ms, chu_cfg->nfc.ttl_ms);
+}
+
 void handle_display(int argc, char *argv[])
 {
-    const char *usage = "Usage: display [colors|style|tof|sense|hid]\n";
+    const char *usage = "Usage: display [colors|style|tof|sense|hid|slider|nfc|led]\n";
     if (argc > 1) {
         printf(usage);
         return;
@@ -88,11 +124,14 @@ void handle_display(int argc, char *argv[])
         disp_tof();
         disp_sense();
         disp_hid();
+        disp_slider();
+        disp_nfc();
+        disp_led();
         return;
     }
 
-    const char *choices[] = {"colors", "style", "tof", "sense", "hid"};
-    switch (cli_match_prefix(choices, 5, argv[0])) {
+    const char *choices[] = {"colors", "style", "tof", "sense", "hid", "slider", "nfc", "led"};
+    switch (cli_match_prefix(choices, 8, argv[0])) {
         case 0:
             disp_colors();
             break;
@@ -108,29 +147,21 @@ void handle_display(int argc, char *argv[])
         case 4:
             disp_hid();
             break;
+        case 5:
+            disp_slider();
+            break;
+        case 6:
+            disp_nfc();
+            break;
+        case 7:
+            disp_led();
+            break;
         default:
             printf(usage);
             break;
     }
 }
 
-static int fps[2];
-void fps_count(int core)
-{
-    static uint32_t last[2] = {0};
-    static int counter[2] = {0};
-
-    counter[core]++;
-
-    uint32_t now = time_us_32();
-    if (now - last[core] < 1000000) {
-        return;
-    }
-    last[core] = now;
-    fps[core] = counter[core];
-    counter[core] = 0;
-}
-
 static void handle_level(int argc, char *argv[])
 {
     const char *usage = "Usage: level <0..255>\n";
@@ -150,6 +181,119 @@ static void handle_level(int argc, char *argv[])
     disp_style();
 }
 
+static void handle_led(int argc, char *argv[])
+{
+    const char *usage = "Usage: led\n"
+                        "       led fps <30..500>\n"
+                        "       led gamma <on|off>\n"
+                        "       led dither <on|off>\n"
+                        "       led white <r> <g> <b>\n";
+    if (argc == 0) {
+        disp_led();
+        return;
+    }
+
+    const char *choices[] = {"fps", "gamma", "white", "dither"};
+    int match = cli_match_prefix(choices, 4, argv[0]);
+
+    if ((match == 0) && (argc == 2)) {
+        int fps = cli_extract_non_neg_int(argv[1], 0);
+        if ((fps < 30) || (fps > 500)) {
+            printf(usage);
+            return;
+        }
+        chu_cfg->led.fps = fps;
+    } else if (((match == 1) || (match == 3)) && (argc == 2)) {
+        const char *on_off[] = {"off", "on"};
+        int on = cli_match_prefix(on_off, 2, argv[1]);
+        if (on < 0) {
+            printf(usage);
+            return;
+        }
+        if (match == 1) {
+            chu_cfg->led.gamma = on;
+        } else {
+            chu_cfg->led.dither = on;
+        }
+    } else if ((match == 2) && (argc == 4)) {
+        int white[3];
+        for (int i = 0; i < 3; i++) {
+            white[i] = cli_extract_non_neg_int(argv[i + 1], 0);
+            if ((white[i] < 0) || (white[i] > 255)) {
+                printf(usage);
+                return;
+            }
+        }
+        if ((white[0] | white[1] | white[2]) == 0) {
+            printf(usage);
+            return;
+        }
+        for (int i = 0; i < 3; i++) {
+            chu_cfg->led.white[i] = white[i];
+        }
+    } else {
+        printf(usage);
+        return;
+    }
+
+    config_changed();
+    disp_led();
+}
+
+static void disp_effect()
+{
+    const lights_stats_t *stats = lights_stats();
+    printf("[Effect]\n");
+    printf("  Key: %d, Gap: %d, Air: %d\n", chu_cfg->style.key,
+           chu_cfg->style.gap, chu_cfg->style.tof);
+    if (!rgb_mapped(RGB_KEY_BASE) || !rgb_mapped(RGB_GAP_BASE)) {
+        printf("  Key/gap LEDs are not on this board's LED chain.\n");
+    }
+    printf("  Frames: %lu, render avg %lu us, max %lu us\n",
+           stats->frames, stats->frame_us, stats->frame_us_max);
+}
+
+static void handle_effect(int argc, char *argv[])
+{
+    const char *usage = "Usage: effect [reset]\n"
+                        "       effect key <0..2>  static, rainbow, breath\n"
+                        "       effect gap <0..1>  static, rainbow\n"
+                        "       effect air <0..1>  level, trail\n";
+    if (argc == 0) {
+        disp_effect();
+        return;
+    }
+
+    const char *choices[] = {"reset", "key", "gap", "air"};
+    int match = cli_match_prefix(choices, 4, argv[0]);
+
+    if ((match == 0) && (argc == 1)) {
+        lights_clear_stats();
+        disp_effect();
+        return;
+    }
+
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
+
+    int value = cli_extract_non_neg_int(argv[1], 0);
+    if ((match == 1) && (value >= 0) && (value < LIGHTS_KEY_NUM)) {
+        chu_cfg->style.key = value;
+    } else if ((match == 2) && (value >= 0) && (value < LIGHTS_GAP_NUM)) {
+        chu_cfg->style.gap = value;
+    } else if ((match == 3) && (value >= 0) && (value < LIGHTS_AIR_NUM)) {
+        chu_cfg->style.tof = value;
+    } else {
+        printf(usage);
+        return;
+    }
+
+    config_changed();
+    disp_effect();
+}
+
 static void handle_hid(int argc, char *argv[])
 {
     const char *usage = "Usage: hid <joy|nkro|both>\n";
@@ -219,9 +363,110 @@ static void handle_tof(int argc, char *argv[])
     disp_tof();
 }
 
-static void handle_save()
+static void disp_save()
 {
-    save_request(true);
+    static const char *waits[] = {"ready", "coalescing changes",
+                                  "min write interval", "input activity"};
+    const save_stats_t *stats = save_stats();
+    printf("[Save]\n");
+    if (stats->pending) {
+        printf("  Pending for %lu ms, waiting for %s.\n", stats->pending_ms,
+               waits[stats->waiting]);
+    } else {
+        printf("  Nothing pending.\n");
+    }
+    printf("  Journal sector %d, seq %lu, %lu bytes used.\n",
+           stats->sector, stats->seq, stats->used);
+    printf("  Writes: %lu since boot, Erases: %lu lifetime.\n",
+           stats->writes, stats->erases);
+    printf("  Flash stall: %lu us, max %lu us.\n",
+           stats->stall_last, stats->stall_max);
+}
+
+static void handle_save(int argc, char *argv[])
+{
+    const char *usage = "Usage: save\n"
+                        "       save status\n";
+    if (argc == 0) {
+        save_request(true);
+        disp_save();
+        return;
+    }
+
+    const char *choices[] = {"status"};
+    if ((argc != 1) || (cli_match_prefix(choices, 1, argv[0]) != 0)) {
+        printf(usage);
+        return;
+    }
+    disp_save();
+}
+
+static void disp_profile()
+{
+    printf("[Profiles]\n");
+    for (int i = 0; i < CONFIG_PROFILE_NUM; i++) {
+        printf("  %c %d: %s\n", i == config_profile() ? '*' : ' ', i + 1,
+               config_profile_name(i));
+    }
+}
+
+/* profile number from 1, or name */
+static int profile_id(const char *param)
+{
+    int id = config_profile_find(param);
+    if (id >= 0) {
+        return id;
+    }
+    id = cli_extract_non_neg_int(param, 0);
+    if ((id < 1) || (id > CONFIG_PROFILE_NUM)) {
+        return -1;
+    }
+    return id - 1;
+}
+
+static void handle_profile(int argc, char *argv[])
+{
+    const char *usage = "Usage: profile\n"
+                        "       profile <1..4|name>\n"
+                        "       profile name <1..4> <name>\n"
+                        "       profile copy <from> <to>\n";
+    if (argc == 0) {
+        disp_profile();
+        return;
+    }
+
+    if (argc == 1) {
+        int id = profile_id(argv[0]);
+        if (id < 0) {
+            printf(usage);
+            return;
+        }
+        config_profile_select(id);
+        disp_profile();
+        return;
+    }
+
+    const char *choices[] = {"name", "copy"};
+    int match = cli_match_prefix(choices, 2, argv[0]);
+    if ((match == 0) && (argc == 3)) {
+        int id = profile_id(argv[1]);
+        if ((id < 0) || !config_profile_rename(id, argv[2])) {
+            printf(usage);
+            return;
+        }
+    } else if ((match == 1) && (argc == 3)) {
+        int from = profile_id(argv[1]);
+        int to = profile_id(argv[2]);
+        if (!config_profile_copy(from, to)) {
+            printf(usage);
+            return;
+        }
+    } else {
+        printf(usage);
+        return;
+    }
+
+    disp_profile();
 }
 
 static void handle_factory_reset()
@@ -230,35 +475,282 @@ static void handle_factory_reset()
     printf("Factory reset done.\n");
 }
 
-static void handle_nfc()
+static void disp_card()
 {
-    i2c_select(I2C_PORT, 1 << 5); // PN532 on IR1 (I2C mux chn 5)
+    static const char *names[] = {"None", "MIFARE", "FeliCa", "ISO14443B"};
+    const card_t *card = card_current();
+    const card_stats_t *stats = card_stats();
+
+    printf("[Card]\n");
+    if (card) {
+        printf("  %s:", names[card->type]);
+        for (int i = 0; i < card->uid_len; i++) {
+            printf(" %02x", card->uid[i]);
+        }
+        printf(", for %llu ms\n", (time_us_64() - card->since) / 1000);
+    } else {
+        printf("  No card\n");
+    }
+    printf("  Polls: %lu, arrivals: %lu, removals: %lu\n",
+           stats->polls, stats->arrivals, stats->removals);
+    printf("  Prefetched: %lu, cache hits: %lu, misses: %lu\n",
+           stats->prefetches, stats->hits, stats->misses);
+    printf("  Card to data: last %lu us, avg %lu us, max %lu us\n",
+           stats->ready_last,
+           stats->ready_cards ? stats->ready_sum / stats->ready_cards : 0,
+           stats->ready_max);
+}
 
-    bool ret = pn532_config_sam();
-    printf("Sam: %d\n", ret);
+static void handle_nfc(int argc, char *argv[])
+{
+    const char *usage = "Usage: nfc\n"
+                        "       nfc poll <5..1000>\n"
+                        "       nfc ttl <50..5000>\n";
+    if (argc == 0) {
+        disp_card();
+        return;
+    }
+
+    if (argc != 2) {
+        printf(usage);
+        return;
+    }
 
-    uint8_t buf[32];
+    const char *choices[] = {"poll", "ttl"};
+    int match = cli_match_prefix(choices, 2, argv[0]);
+    int value = cli_extract_non_neg_int(argv[1], 0);
 
-    int len = sizeof(buf);
-    ret = pn532_poll_mifare(buf, &len);
-    printf("Mifare: %d -", len);
+    if ((match == 0) && (value >= 5) && (value <= 1000)) {
+        chu_cfg->nfc.poll_ms = value;
+    } else if ((match == 1) && (value >= 50) && (value <= 5000)) {
+        chu_cfg->nfc.ttl_ms = value;
+    } else {
+        printf(usage);
+        return;
+    }
 
-    if (ret) {
-        for (int i = 0; i < len; i++) {
-            printf(" %02x", buf[i]);
+    config_changed();
+    disp_nfc();
+}
+
+static void disp_slider_stats()
+{
+    const slider_stats_t *stats = slider_stats();
+    printf("[Slider Bridge]\n");
+    printf("  Baud: %lu\n", stats->baud);
+    printf("  RX: %lu bytes, %lu B/s\n", stats->rx_bytes, stats->rx_rate);
+    printf("  TX: %lu bytes, %lu B/s\n", stats->tx_bytes, stats->tx_rate);
+    printf("  USB flushes: %lu, %lu bytes each\n", stats->flushes,
+           stats->flushes ? stats->rx_bytes / stats->flushes : 0);
+    printf("  Latency: avg %lu us, max %lu us\n",
+           stats->flushes ? stats->latency_sum / stats->flushes : 0,
+           stats->latency_max);
+    printf("  Overruns: %lu\n", stats->overruns);
+    printf("  Frames: RX %lu (%lu bad), TX %lu (%lu bad)\n",
+           stats->rx_frames, stats->rx_errors,
+           stats->tx_frames, stats->tx_errors);
+    printf("  Host LED: %lu, %lu replaced\n",
+           stats->host_leds, stats->led_replaced);
+    printf("  Touch: %08lx, host %s\n", slider_touch(),
+           slider_host_active() ? "active" : "idle");
+}
+
+static void handle_slider(int argc, char *argv[])
+{
+    const char *usage = "Usage: slider [reset]\n"
+                        "       slider baud <host|9600..3000000>\n"
+                        "       slider flow <on|off>\n";
+    if (argc == 0) {
+        disp_slider_stats();
+        return;
+    }
+
+    const char *choices[] = {"reset", "baud", "flow"};
+    int match = cli_match_prefix(choices, 3, argv[0]);
+
+    if ((match == 0) && (argc == 1)) {
+        slider_clear_stats();
+        disp_slider_stats();
+        return;
+    }
+
+    if ((match == 1) && (argc == 2)) {
+        const char *host[] = {"host"};
+        int baud = 0;
+        if (cli_match_prefix(host, 1, argv[1]) != 0) {
+            baud = cli_extract_non_neg_int(argv[1], 0);
+            if ((baud < 9600) || (baud > 3000000)) {
+                printf(usage);
+                return;
+            }
         }
+        chu_cfg->slider.baud = baud;
+        slider_config_changed();
+        config_changed();
+        disp_slider();
+        return;
     }
-    printf("\n");
 
-    printf("Felica: ");
-    if (pn532_poll_felica(buf, buf + 8, buf + 16, false)) {
-        for (int i = 0; i < 18; i++) {
-            printf(" %02x%s", buf[i], (i % 8 == 7) ? "," : "");
+    if ((match == 2) && (argc == 2)) {
+        const char *on_off[] = {"off", "on"};
+        int on = cli_match_prefix(on_off, 2, argv[1]);
+        if (on < 0) {
+            printf(usage);
+            return;
         }
+        if (!slider_set_flow(on)) {
+            printf("No flow control pins on this board.\n");
+            return;
+        }
+        chu_cfg->slider.flow = on;
+        config_changed();
+        disp_slider();
+        return;
+    }
+
+    printf(usage);
+}
+
+static void print_us(uint32_t cycles)
+{
+    uint32_t hundredths = (uint64_t)cycles * 100 / metrics_cycles_per_us();
+    printf(" %6lu.%02lu", hundredths / 100, hundredths % 100);
+}
+
+static void disp_stats()
+{
+    printf("[Loops]\n");
+    printf("  core 0: %lu/s, core 1: %lu/s, HID reports: %lu/s\n",
+           metrics_rate(METRIC_LOOPS0), metrics_rate(METRIC_LOOPS1),
+           metrics_rate(METRIC_HID_REPORTS));
+
+    printf("[Stages] us\n");
+    printf("  %-8s %10s %9s %9s %9s %9s %9s %9s\n", "stage", "count",
+           "min", "avg", "p50", "p90", "p99", "max");
+    for (int i = 0; i < METRIC_STAGE_NUM; i++) {
+        metric_summary_t sum;
+        metrics_summary(i, &sum);
+        printf("  %-8s %10lu", metrics_stage_name(i), sum.count);
+        print_us(sum.min);
+        print_us(sum.avg);
+        print_us(sum.p50);
+        print_us(sum.p90);
+        print_us(sum.p99);
+        print_us(sum.max);
+        printf("\n");
+    }
+
+    const console_stats_t *console = console_stats();
+    printf("[Console]\n");
+    printf("  %lu bytes out in %lu us, %lu lines dropped, peak %lu bytes queued\n",
+           console->bytes, console->drain_us, console->dropped_lines, console->peak);
+}
+
+/* One JSON line, times in cpu cycles */
+static void dump_stats()
+{
+    printf("{\"cycles_per_us\":%lu,\"counters\":{", metrics_cycles_per_us());
+    for (int i = 0; i < METRIC_COUNTER_NUM; i++) {
+        printf("%s\"%s\":{\"total\":%lu,\"rate\":%lu}", i ? "," : "",
+               metrics_counter_name(i), metrics_total(i), metrics_rate(i));
+    }
+    printf("},\"stages\":{");
+    for (int i = 0; i < METRIC_STAGE_NUM; i++) {
+        metric_summary_t sum;
+        metrics_summary(i, &sum);
+        printf("%s\"%s\":{\"n\":%lu,\"min\":%lu,\"avg\":%lu,\"p50\":%lu,"
+               "\"p90\":%lu,\"p99\":%lu,\"max\":%lu}", i ? "," : "",
+               metrics_stage_name(i), sum.count, sum.min, sum.avg, sum.p50,
+               sum.p90, sum.p99, sum.max);
+    }
+    printf("}}\n");
+}
+
+static void handle_stats(int argc, char *argv[])
+{
+    const char *usage = "Usage: stats [reset|dump]\n";
+    if (argc == 0) {
+        disp_stats();
+        return;
+    }
+
+    const char *choices[] = {"reset", "dump"};
+    int match = argc == 1 ? cli_match_prefix(choices, 2, argv[0]) : -1;
+    if (match == 0) {
+        metrics_reset();
+        printf("Stats reset.\n");
+    } else if (match == 1) {
+        dump_stats();
+    } else {
+        printf(usage);
+    }
+}
+
+static void watch_tof()
+{
+    printf("[ToF] offset %d mm, pitch %d mm\n", chu_cfg->tof.offset,
+           chu_cfg->tof.pitch);
+    for (int i = 0; i < air_num(); i++) {
+        printf("  %2d: %5d mm  zone %d\n", i, air_raw(i) / 10, air_value(i));
+    }
+}
+
+static void watch_air()
+{
+    uint8_t bitmap = air_bitmap();
+    printf("[Air]\n ");
+    for (int i = 5; i >= 0; i--) {
+        printf(" %s", (bitmap & (1 << i)) ? "##" : "--");
+    }
+    printf("\n");
+}
+
+static void watch_buttons()
+{
+    printf("[Buttons]\n ");
+    for (int i = 0; i < button_num(); i++) {
+        printf(" %d:%s", i, button_pressed(i) ? "ON " : "off");
     }
     printf("\n");
 }
 
+static struct {
+    uint32_t tof;
+    uint32_t nfc;
+} i2c_base;
+
+static void watch_i2c()
+{
+    uint32_t tof = air_i2c_errors();
+    uint32_t nfc = pn532_errors();
+    printf("[I2C errors] total, since watch started\n");
+    printf("  ToF:   %8lu %8lu\n", tof, tof - i2c_base.tof);
+    printf("  PN532: %8lu %8lu\n", nfc, nfc - i2c_base.nfc);
+}
+
+static void handle_watch(int argc, char *argv[])
+{
+    const char *usage = "Usage: watch <tof|air|buttons|stats|i2c> [1..30 Hz]\n";
+    if ((argc < 1) || (argc > 2)) {
+        printf(usage);
+        return;
+    }
+
+    const char *choices[] = {"tof", "air", "buttons", "stats", "i2c"};
+    const cli_watch_t draws[] = {watch_tof, watch_air, watch_buttons,
+                                 disp_stats, watch_i2c};
+    int match = cli_match_prefix(choices, 5, argv[0]);
+    int hz = (argc == 2) ? cli_extract_non_neg_int(argv[1], 0) : 5;
+    if ((match < 0) || (hz < 1) || (hz > 30)) {
+        printf(usage);
+        return;
+    }
+
+    i2c_base.tof = air_i2c_errors();
+    i2c_base.nfc = pn532_errors();
+    cli_watch(draws[match], 1000000 / hz);
+}
+
 void handle_whoami()
 {
     const char *msg[] = {"\nThis is Command Line port.\n",
@@ -274,10 +766,17 @@ void commands_init()
 {
     cli_register("display", handle_display, "Display all config.");
     cli_register("level", handle_level, "Set LED brightness level.");
+    cli_register("led", handle_led, "LED frame rate, gamma, dither and white balance.");
+    cli_register("effect", handle_effect, "LED effects and frame time.");
     cli_register("hid", handle_hid, "Set HID mode.");
     cli_register("tof", handle_tof, "Set ToF config.");
-    cli_register("save", handle_save, "Save config to flash.");
+    cli_register("save", handle_save, "Save config to flash, or show save status.");
     cli_register("factory", handle_factory_reset, "Reset everything to default.");
-    cli_register("nfc", handle_nfc, "NFC debug.");
+    cli_register("profile", handle_profile, "List, switch, name and copy profiles.");
+    cli_register("nfc", handle_nfc, "NFC card tracker status and config.");
     cli_register("whoami", handle_whoami, "Tell each port.");
+    cli_register("stats", handle_stats, "Loop stage timings and counters.");
+    cli_register("watch", handle_watch, "Live view of sensors and stats.");
+    cli_register("slider", handle_slider, "Slider bridge stats and link config.");
+    cli_json(batch_process);
 }
@@ -7,9 +7,18 @@
  */
 
 #include "config.h"
+
+#include <string.h>
+
 #include "save.h"
+#include "lights.h"
+#include "slider.h"
+#include "trace.h"
+
+chu_cfg_t *chu_cfg; // active profile
 
-chu_cfg_t *chu_cfg;
+static chu_cfg_t *base_cfg; // profile 0, the original config image
+static chu_profiles_t *profiles;
 
 static chu_cfg_t default_cfg = {
     .colors = {
@@ -38,42 +47,124 @@ static chu_cfg_t default_cfg = {
         .joy = 1,
         .nkro = 0,
     },
+    .slider = {
+        .baud = 0,
+        .flow = 0,
+    },
+    .nfc = {
+        .poll_ms = 20,
+        .ttl_ms = 500,
+    },
+    .led = {
+        .fps = 250,
+        .gamma = 0,
+        .white = { 255, 255, 255 },
+        .dither = 0,
+    },
+};
+
+static chu_profiles_t default_profiles = {
+    .active = 0,
+    .names = { "default", "profile2", "profile3", "profile4" },
 };
 
 chu_runtime_t *chu_runtime;
 
-static void config_loaded()
+/* Fixes out of range values with defaults, true if there were any */
+static bool config_validate(chu_cfg_t *cfg)
 {
-    if (chu_cfg->style.level > 10) {
-        chu_cfg->style.level = default_cfg.style.level;
-        config_changed();
+    bool fixed = false;
+    if ((cfg->style.key >= LIGHTS_KEY_NUM) ||
+        (cfg->style.gap >= LIGHTS_GAP_NUM) ||
+        (cfg->style.tof >= LIGHTS_AIR_NUM)) {
+        cfg->style.key = default_cfg.style.key;
+        cfg->style.gap = default_cfg.style.gap;
+        cfg->style.tof = default_cfg.style.tof;
+        fixed = true;
     }
-    if ((chu_cfg->tof.offset < 40) ||
-        (chu_cfg->tof.pitch < 4) || (chu_cfg->tof.pitch > 50)) {
-        chu_cfg->tof = default_cfg.tof;
-        config_changed();
+    if ((cfg->tof.offset < 40) ||
+        (cfg->tof.pitch < 4) || (cfg->tof.pitch > 50)) {
+        cfg->tof = default_cfg.tof;
+        fixed = true;
     }
-    if ((chu_cfg->sense.filter & 0x0f) > 3 ||
-        ((chu_cfg->sense.filter >> 4) & 0x0f) > 3) {
-        chu_cfg->sense.filter = default_cfg.sense.filter;
-        config_changed();
+    if ((cfg->sense.filter & 0x0f) > 3 ||
+        ((cfg->sense.filter >> 4) & 0x0f) > 3) {
+        cfg->sense.filter = default_cfg.sense.filter;
+        fixed = true;
     }
-    if ((chu_cfg->sense.global > 9) || (chu_cfg->sense.global < -9)) {
-        chu_cfg->sense.global = default_cfg.sense.global;
-        config_changed();
+    if ((cfg->sense.global > 9) || (cfg->sense.global < -9)) {
+        cfg->sense.global = default_cfg.sense.global;
+        fixed = true;
     }
     for (int i = 0; i < 32; i++) {
-        if ((chu_cfg->sense.keys[i] > 9) || (chu_cfg->sense.keys[i] < -9)) {
-            chu_cfg->sense.keys[i] = default_cfg.sense.keys[i];
+        if ((cfg->sense.keys[i] > 9) || (cfg->sense.keys[i] < -9)) {
+            cfg->sense.keys[i] = default_cfg.sense.keys[i];
+            fixed = true;
+        }
+    }
+    if ((cfg->sense.debounce_touch > 7) |
+        (cfg->sense.debounce_release > 7)) {
+        cfg->sense.debounce_touch = default_cfg.sense.debounce_touch;
+        cfg->sense.debounce_release = default_cfg.sense.debounce_release;
+        fixed = true;
+    }
+    if ((cfg->slider.baud != 0) &&
+        ((cfg->slider.baud < 9600) || (cfg->slider.baud > 3000000))) {
+        cfg->slider.baud = default_cfg.slider.baud;
+        fixed = true;
+    }
+    if (cfg->slider.flow > 1) {
+        cfg->slider.flow = default_cfg.slider.flow;
+        fixed = true;
+    }
+    if ((cfg->nfc.poll_ms < 5) || (cfg->nfc.poll_ms > 1000) ||
+        (cfg->nfc.ttl_ms < 50) || (cfg->nfc.ttl_ms > 5000)) {
+        cfg->nfc = default_cfg.nfc;
+        fixed = true;
+    }
+    if ((cfg->led.fps < 30) || (cfg->led.fps > 500) ||
+        (cfg->led.gamma > 1) || (cfg->led.dither > 1) ||
+        ((cfg->led.white[0] | cfg->led.white[1] | cfg->led.white[2]) == 0)) {
+        cfg->led = default_cfg.led;
+        fixed = true;
+    }
+    return fixed;
+}
+
+static void config_loaded()
+{
+    if (config_validate(base_cfg)) {
+        config_changed();
+    }
+}
+
+static chu_cfg_t *profile_cfg(int id)
+{
+    return id == 0 ? base_cfg : &profiles->extra[id - 1];
+}
+
+/* all profiles are validated here, switching later is just a pointer swap */
+static void profiles_loaded()
+{
+    for (int i = 1; i < CONFIG_PROFILE_NUM; i++) {
+        if (config_validate(profile_cfg(i))) {
             config_changed();
         }
     }
-    if ((chu_cfg->sense.debounce_touch > 7) |
-        (chu_cfg->sense.debounce_release > 7)) {
-        chu_cfg->sense.debounce_touch = default_cfg.sense.debounce_touch;
-        chu_cfg->sense.debounce_release = default_cfg.sense.debounce_release;
+    for (int i = 0; i < CONFIG_PROFILE_NUM; i++) {
+        profiles->names[i][CONFIG_PROFILE_NAME_LEN - 1] = '\0';
+    }
+    if (profiles->active >= CONFIG_PROFILE_NUM) {
+        profiles->active = 0;
         config_changed();
     }
+    chu_cfg = profile_cfg(profiles->active);
+}
+
+bool config_check(const chu_cfg_t *cfg)
+{
+    chu_cfg_t tmp = *cfg;
+    return !config_validate(&tmp);
 }
 
 void config_changed()
@@ -83,11 +174,95 @@ void config_changed()
 
 void config_factory_reset()
 {
-    *chu_cfg = default_cfg;
+    for (int i = 0; i < CONFIG_PROFILE_NUM; i++) {
+        *profile_cfg(i) = default_cfg;
+    }
+    *profiles = default_profiles;
+    chu_cfg = base_cfg;
+    slider_config_changed();
     save_request(true);
 }
 
+int config_profile()
+{
+    return profiles->active;
+}
+
+const char *config_profile_name(int id)
+{
+    if ((id < 0) || (id >= CONFIG_PROFILE_NUM)) {
+        return NULL;
+    }
+    return profiles->names[id];
+}
+
+int config_profile_find(const char *name)
+{
+    for (int i = 0; i < CONFIG_PROFILE_NUM; i++) {
+        if (strcmp(profiles->names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Only what really differs gets rebuilt, LED tables follow by themselves */
+bool config_profile_select(int id)
+{
+    if ((id < 0) || (id >= CONFIG_PROFILE_NUM)) {
+        return false;
+    }
+
+    const chu_cfg_t *old = chu_cfg;
+    chu_cfg_t *cfg = profile_cfg(id);
+    chu_cfg = cfg;
+    TRACE_INSTANT(TRACE_PROFILE, id);
+
+    if (memcmp(&old->slider, &cfg->slider, sizeof(cfg->slider)) != 0) {
+        slider_config_changed();
+    }
+
+    if (profiles->active != id) {
+        profiles->active = id;
+        config_changed(); // remembered later, not a flash write now
+    }
+    return true;
+}
+
+bool config_profile_rename(int id, const char *name)
+{
+    if ((id < 0) || (id >= CONFIG_PROFILE_NUM) ||
+        (strlen(name) >= CONFIG_PROFILE_NAME_LEN)) {
+        return false;
+    }
+    strcpy(profiles->names[id], name);
+    config_changed();
+    return true;
+}
+
+bool config_profile_copy(int from, int to)
+{
+    if ((from < 0) || (from >= CONFIG_PROFILE_NUM) ||
+        (to < 0) || (to >= CONFIG_PROFILE_NUM)) {
+        return false;
+    }
+    if (from != to) {
+        *profile_cfg(to) = *profile_cfg(from);
+        if (to == profiles->active) {
+            slider_config_changed();
+        }
+        config_changed();
+    }
+    return true;
+}
+
 void config_init()
 {
-    chu_cfg = (chu_cfg_t *)save_alloc(sizeof(*chu_cfg), &default_cfg, config_loaded);
+    for (int i = 0; i < CONFIG_PROFILE_NUM - 1; i++) {
+        default_profiles.extra[i] = default_cfg;
+    }
+    base_cfg = (chu_cfg_t *)save_alloc(sizeof(*base_cfg), &default_cfg, config_loaded);
+    profiles = (chu_profiles_t *)save_alloc(sizeof(*profiles), &default_profiles,
+                                            profiles_loaded);
+    chu_cfg = base_cfg;
 }
@@ -38,8 +38,31 @@ typedef struct __attribute__((packed)) {
         uint8_t joy : 4;
         uint8_t nkro : 4;
     } hid;
+    struct {
+        uint32_t baud; // 0: follow host line coding
+        uint8_t flow;
+    } slider;
+    struct {
+        uint16_t poll_ms; // background card poll interval
+        uint16_t ttl_ms; // card is gone after missing this long
+    } nfc;
+    struct {
+        uint16_t fps;
+        uint8_t gamma;
+        uint8_t white[3]; // white balance, per channel scale of r, g, b
+        uint8_t dither;
+    } led;
 } chu_cfg_t;
 
+#define CONFIG_PROFILE_NUM 4
+#define CONFIG_PROFILE_NAME_LEN 12
+
+typedef struct __attribute__((packed)) {
+    uint8_t active;
+    char names[CONFIG_PROFILE_NUM][CONFIG_PROFILE_NAME_LEN];
+    chu_cfg_t extra[CONFIG_PROFILE_NUM - 1]; // profile 0 is the base chu_cfg
+} chu_profiles_t;
+
 typedef struct {
     uint16_t fps[2];
 } chu_runtime_t;
@@ -49,6 +72,15 @@ extern chu_runtime_t *chu_runtime;
 
 void config_init();
 void config_changed(); // Notify the config has changed
+bool config_check(const chu_cfg_t *cfg); // all values in range
 void config_factory_reset(); // Reset the config to factory default
 
+/* Profiles, chu_cfg always points to the active one */
+int config_profile();
+const char *config_profile_name(int id);
+int config_profile_find(const char *name); // -1 if not found
+bool config_profile_select(int id); // instant, no flash write
+bool config_profile_rename(int id, const char *name);
+bool config_profile_copy(int from, int to);
+
 #endif
@@ -0,0 +1,162 @@
+/*
+ * Buffered Console on the CLI CDC
+ * WHowe <github.com/whowechina>
+ *
+ * stdio goes to a ring instead of straight to USB, so a host that doesn't
+ * read the port can't stall the input loop. When the ring is full, whole
+ * lines are dropped and counted, and a note shows up once there's room.
+ */
+
+#include "console.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdio.h"
+#include "pico/stdio/driver.h"
+#include "pico/stdlib.h"
+
+#include "tusb.h"
+
+#define CONSOLE_CDC 0
+#define RING_SIZE 4096 // power of 2
+#define RING_MASK (RING_SIZE - 1)
+
+static struct {
+    char buf[RING_SIZE];
+    volatile uint32_t head; // written by stdio, serialized by its mutex
+    volatile uint32_t tail; // read by console_drain() on core0
+    bool dropping; // rest of a dropped line is still coming
+    bool line_start;
+    uint32_t reported; // dropped lines already noted in the output
+} ring = { .line_start = true };
+
+static console_stats_t stats;
+
+static inline uint32_t ring_used()
+{
+    return ring.head - ring.tail;
+}
+
+static void ring_put(const char *s, int len)
+{
+    for (int i = 0; i < len; i++) {
+        ring.buf[(ring.head + i) & RING_MASK] = s[i];
+    }
+    ring.head += len;
+    ring.line_start = (s[len - 1] == '\n');
+
+    if (ring_used() > stats.peak) {
+        stats.peak = ring_used();
+    }
+}
+
+static void note_drops()
+{
+    if (!ring.line_start || (ring.reported == stats.dropped_lines)) {
+        return;
+    }
+
+    char note[40];
+    int len = snprintf(note, sizeof(note), "[%lu lines dropped]\r\n",
+                       stats.dropped_lines - ring.reported);
+    if (len <= RING_SIZE - ring_used()) {
+        ring_put(note, len);
+        ring.reported = stats.dropped_lines;
+    }
+}
+
+static void console_out_chars(const char *s, int len)
+{
+    if (ring.dropping) {
+        const char *eol = memchr(s, '\n', len);
+        if (!eol) {
+            return;
+        }
+        ring.dropping = false;
+        len -= eol + 1 - s;
+        s = eol + 1;
+    }
+
+    if (len <= 0) {
+        return;
+    }
+
+    note_drops();
+
+    if (len > RING_SIZE - ring_used()) {
+        stats.dropped_lines++;
+        ring.dropping = (s[len - 1] != '\n');
+        return;
+    }
+
+    ring_put(s, len);
+}
+
+static int console_in_chars(char *buf, int len)
+{
+    if (!tud_cdc_n_available(CONSOLE_CDC)) {
+        return PICO_ERROR_NO_DATA;
+    }
+    return tud_cdc_n_read(CONSOLE_CDC, buf, len);
+}
+
+static stdio_driver_t console_driver = {
+    .out_chars = console_out_chars,
+    .in_chars = console_in_chars,
+    .crlf_enabled = true,
+};
+
+void console_init()
+{
+    stdio_set_driver_enabled(&console_driver, true);
+}
+
+void console_drain()
+{
+    uint32_t used = ring_used();
+    if ((used == 0) || !tud_cdc_n_connected(CONSOLE_CDC)) {
+        return;
+    }
+
+    uint64_t start = time_us_64();
+    uint32_t space = tud_cdc_n_write_available(CONSOLE_CDC);
+    while ((used > 0) && (space > 0)) {
+        uint32_t index = ring.tail & RING_MASK;
+        uint32_t chunk = RING_SIZE - index;
+        chunk = chunk < used ? chunk : used;
+        chunk = chunk < space ? chunk : space;
+
+        uint32_t n = tud_cdc_n_write(CONSOLE_CDC, ring.buf + index, chunk);
+        if (n == 0) {
+            break;
+        }
+        ring.tail += n;
+        stats.bytes += n;
+        used -= n;
+        space -= n;
+    }
+    tud_cdc_n_write_flush(CONSOLE_CDC);
+    stats.drain_us += time_us_64() - start;
+}
+
+void console_flush(uint32_t timeout_us)
+{
+    uint64_t start = time_us_64();
+    while ((ring_used() > 0) && (time_us_64() - start < timeout_us)) {
+        tud_task();
+        console_drain();
+    }
+}
+
+uint32_t console_room()
+{
+    return RING_SIZE - ring_used();
+}
+
+const console_stats_t *console_stats()
+{
+    return &stats;
+}
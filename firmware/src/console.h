@@ -0,0 +1,32 @@
+/*
+ * Buffered Console on the CLI CDC
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t bytes; // sent to USB
+    uint32_t dropped_lines;
+    uint32_t peak; // max bytes waiting in the ring
+    uint32_t drain_us; // time spent handing bytes to USB
+} console_stats_t;
+
+/* Takes over stdio, printf() only queues into a ring and never waits */
+void console_init();
+
+/* Moves what USB can take right now, call it after tud_task() */
+void console_drain();
+
+/* Drains for up to timeout_us, for the rare "print and reboot" cases */
+void console_flush(uint32_t timeout_us);
+
+uint32_t console_room(); // bytes free in the ring
+
+const console_stats_t *console_stats();
+
+#endif
@@ -63,14 +63,18 @@ static inline bool gp2y0e_is_present()
     return bytes == 1;
 }
 
+extern uint32_t gp2y0e_errors; // failed I2C transfers of distance reads, in air.c
+
 static inline uint16_t gp2y0e_dist_mm()
 {
     uint8_t cmd[] = {0x5e};
-    i2c_write_blocking_until(gp2y0e_port, GP2Y0E_DEF_ADDR, cmd, 1,
-                             true, time_us_64() + 1000);
-    uint8_t data;
-    i2c_read_blocking_until(gp2y0e_port, GP2Y0E_DEF_ADDR, &data, 1,
-                             false, time_us_64() + 1000);
+    int ret = i2c_write_blocking_until(gp2y0e_port, GP2Y0E_DEF_ADDR, cmd, 1,
+                                       true, time_us_64() + 1000);
+    uint8_t data = 0;
+    if ((ret < 0) || (i2c_read_blocking_until(gp2y0e_port, GP2Y0E_DEF_ADDR, &data, 1,
+                                              false, time_us_64() + 1000) < 0)) {
+        gp2y0e_errors++;
+    }
 
     return data * 10 / 4;
 }
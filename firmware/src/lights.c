@@ -0,0 +1,195 @@
+/*
+ * Chu Arcade LED Effects
+ * WHowe <github.com/whowechina>
+ *
+ * Layers are composed per frame: a base (static, rainbow or breath) for keys
+ * and gaps, touch reactions fading out on keys, and air indicators showing
+ * hand height, optionally leaving a fading trail. Time is kept in fixed
+ * point (1/1024 s ticks for phase, 8.8 intensities for fades), so a frame
+ * costs the same no matter how late it runs.
+ *
+ * Key and gap layers only show on boards whose RGB_LAYOUT maps them. On
+ * chu_arcade those LEDs are on the slider, so only the air layer is
+ * visible and the other two are not rendered at all.
+ */
+
+#include "lights.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bsp/board.h"
+
+#include "config.h"
+#include "rgb.h"
+#include "air.h"
+#include "slider.h"
+
+#define HOST_HOLD_US 1000000
+#define KEY_FADE_PER_MS 0x0180 // 8.8 intensity lost per ms, 0xffff fades in ~170ms
+#define AIR_FADE_PER_MS 0x0083 // ~500ms trail
+
+static uint64_t host_time;
+static uint64_t last_frame;
+
+static uint16_t key_fade[RGB_KEY_NUM]; // 8.8 intensity of touch reaction
+static uint32_t key_color[RGB_KEY_NUM]; // color of the last touch
+static uint16_t air_fade[RGB_AIR_NUM];
+static uint32_t air_color[RGB_AIR_NUM];
+
+static lights_stats_t stats;
+
+static const uint32_t air_colors[] = { 0x080808, 0x000080, 0x800000, 0x008000,
+                                       0x008080, 0x808000, 0x800080 };
+
+static inline uint32_t blend(uint32_t a, uint32_t b, uint32_t alpha)
+{
+    uint32_t inv = 256 - alpha;
+    uint32_t r = (((a >> 16) & 0xff) * inv + ((b >> 16) & 0xff) * alpha) >> 8;
+    uint32_t g = (((a >> 8) & 0xff) * inv + ((b >> 8) & 0xff) * alpha) >> 8;
+    uint32_t bl = ((a & 0xff) * inv + (b & 0xff) * alpha) >> 8;
+    return r << 16 | g << 8 | bl;
+}
+
+static inline uint32_t scale(uint32_t color, uint32_t level)
+{
+    return blend(0, color, level);
+}
+
+static inline uint16_t fade(uint16_t value, uint32_t amount)
+{
+    return value > amount ? value - amount : 0;
+}
+
+/* tick is 1/1024 s, the hue runs a full circle in 4s */
+static inline uint32_t rainbow(uint32_t tick, int pos, int span)
+{
+    uint8_t hue = (tick >> 4) + pos * 256 / span;
+    return rgb32_from_hsv(hue, 255, 255);
+}
+
+static inline uint32_t breath(uint32_t tick, uint32_t color)
+{
+    uint32_t phase = (tick >> 3) & 0xff; // 2s period
+    uint32_t level = phase < 128 ? phase * 2 : (255 - phase) * 2;
+    return scale(color, level + 1);
+}
+
+static void render_keys(uint32_t tick, uint32_t fade_amount)
+{
+    uint32_t touch = slider_touch();
+
+    for (int i = 0; i < RGB_KEY_NUM; i++) {
+        uint32_t base;
+        switch (chu_cfg->style.key) {
+            case LIGHTS_KEY_RAINBOW:
+                base = rainbow(tick, i, RGB_KEY_NUM);
+                break;
+            case LIGHTS_KEY_BREATH:
+                base = breath(tick, chu_cfg->colors.key_off);
+                break;
+            default:
+                base = chu_cfg->colors.key_off;
+                break;
+        }
+
+        bool upper = touch & (1ul << (i * 2));
+        bool lower = touch & (1ul << (i * 2 + 1));
+        if (upper || lower) {
+            key_fade[i] = 0xffff;
+            key_color[i] = (upper && lower) ? chu_cfg->colors.key_on_both :
+                           upper ? chu_cfg->colors.key_on_upper :
+                                   chu_cfg->colors.key_on_lower;
+        } else {
+            key_fade[i] = fade(key_fade[i], fade_amount);
+        }
+
+        uint32_t color = blend(base, key_color[i], (key_fade[i] >> 8) + 1);
+        rgb_set_color(RGB_KEY_BASE + i, key_fade[i] ? color : base);
+    }
+}
+
+static void render_gaps(uint32_t tick)
+{
+    for (int i = 0; i < RGB_GAP_NUM; i++) {
+        uint32_t color = chu_cfg->colors.gap;
+        if (chu_cfg->style.gap == LIGHTS_GAP_RAINBOW) {
+            color = rainbow(tick, i, RGB_GAP_NUM);
+        }
+        rgb_set_color(RGB_GAP_BASE + i, color);
+    }
+}
+
+static void render_air(uint32_t fade_amount)
+{
+    int num = air_num() < RGB_AIR_NUM ? air_num() : RGB_AIR_NUM;
+    for (int i = 0; i < num; i++) {
+        int d = air_value(i);
+        if (chu_cfg->style.tof != LIGHTS_AIR_TRAIL) {
+            rgb_set_color(RGB_AIR_BASE + i, air_colors[d]);
+            continue;
+        }
+
+        if (d) {
+            air_fade[i] = 0xffff;
+            air_color[i] = air_colors[d];
+        } else {
+            air_fade[i] = fade(air_fade[i], fade_amount);
+        }
+        uint32_t color = scale(air_color[i], (air_fade[i] >> 8) + 1);
+        rgb_set_color(RGB_AIR_BASE + i, air_fade[i] ? color : air_colors[0]);
+    }
+}
+
+void lights_update()
+{
+    uint64_t now = time_us_64();
+
+    if (now - last_frame < 1000000 / chu_cfg->led.fps) {
+        return;
+    }
+    uint32_t elapsed_ms = (now - last_frame) / 1000;
+    last_frame = now;
+
+    if (now - host_time < HOST_HOLD_US) {
+        return;
+    }
+
+    if (elapsed_ms > 255) {
+        elapsed_ms = 255; // after a pause just finish the fades
+    }
+    uint32_t tick = now >> 10;
+
+    uint32_t start = time_us_32();
+
+    if (rgb_mapped(RGB_KEY_BASE)) {
+        render_keys(tick, elapsed_ms * KEY_FADE_PER_MS);
+    }
+    if (rgb_mapped(RGB_GAP_BASE)) {
+        render_gaps(tick);
+    }
+    render_air(elapsed_ms * AIR_FADE_PER_MS);
+
+    uint32_t cost = time_us_32() - start;
+    stats.frames++;
+    stats.frame_us = (stats.frame_us * 15 + cost) / 16;
+    if (cost > stats.frame_us_max) {
+        stats.frame_us_max = cost;
+    }
+}
+
+void lights_host_frame()
+{
+    host_time = time_us_64();
+}
+
+const lights_stats_t *lights_stats()
+{
+    return &stats;
+}
+
+void lights_clear_stats()
+{
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,46 @@
+/*
+ * Chu Arcade LED Effects
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* chu_cfg->style.key/gap/tof pick these */
+enum {
+    LIGHTS_KEY_STATIC = 0,
+    LIGHTS_KEY_RAINBOW,
+    LIGHTS_KEY_BREATH,
+    LIGHTS_KEY_NUM,
+};
+
+enum {
+    LIGHTS_GAP_STATIC = 0,
+    LIGHTS_GAP_RAINBOW,
+    LIGHTS_GAP_NUM,
+};
+
+enum {
+    LIGHTS_AIR_LEVEL = 0,
+    LIGHTS_AIR_TRAIL,
+    LIGHTS_AIR_NUM,
+};
+
+typedef struct {
+    uint32_t frames;
+    uint32_t frame_us; // average render time
+    uint32_t frame_us_max;
+} lights_stats_t;
+
+void lights_update(); // on core1, renders a frame when it's due
+
+/* Host painted the LEDs itself, effects stay away for a while */
+void lights_host_frame();
+
+const lights_stats_t *lights_stats();
+void lights_clear_stats();
+
+#endif
@@ -28,11 +28,18 @@
 #include "save.h"
 #include "config.h"
 #include "cli.h"
+#include "console.h"
+#include "metrics.h"
+#include "trace.h"
 #include "commands.h"
+#include "vendor.h"
+#include "aime.h"
 
 #include "air.h"
 #include "rgb.h"
+#include "lights.h"
 #include "button.h"
+#include "slider.h"
 
 struct __attribute__((packed)) {
     uint16_t adcs[8];
@@ -54,11 +61,14 @@ void report_usb_hid()
     if (tud_hid_ready()) {
         if (chu_cfg->hid.joy) {
             tud_hid_n_report(0, REPORT_ID_JOYSTICK, &hid_joy, sizeof(hid_joy));
+            TRACE_INSTANT(TRACE_HID, 0);
+            metrics_count(METRIC_HID_REPORTS);
         }
         if (chu_cfg->hid.nkro &&
             (memcmp(&hid_nkro, &sent_hid_nkro, sizeof(hid_nkro)) != 0)) {
             sent_hid_nkro = hid_nkro;
             tud_hid_n_report(1, 0, &sent_hid_nkro, sizeof(sent_hid_nkro));
+            TRACE_INSTANT(TRACE_HID, 1);
         }
     }
 }
@@ -104,12 +114,14 @@ const uint8_t keycode_table[128][2] = { HID_ASCII_TO_KEYCODE };
 const uint8_t keymap[38 + 1] = NKRO_KEYMAP; // 32 keys, 6 air keys, 1 terminator
 static void gen_nkro_report()
 {
+    uint32_t touch = slider_touch();
     uint8_t air = air_bitmap();
-    for (int i = 0; i < 6; i++) {
-        uint8_t code = keycode_table[keymap[32 + i]][1];
+    for (int i = 0; i < 38; i++) {
+        bool pressed = (i < 32) ? touch & (1ul << i) : air & (1 << (i - 32));
+        uint8_t code = keycode_table[keymap[i]][1];
         uint8_t byte = code / 8;
         uint8_t bit = code % 8;
-        if (air & (1 << i)) {
+        if (pressed) {
             hid_nkro.keymap[byte] |= (1 << bit);
         } else {
             hid_nkro.keymap[byte] &= ~(1 << bit);
@@ -117,79 +129,97 @@ static void gen_nkro_report()
     }
 }
 
-static uint64_t last_hid_time = 0;
-
-static void run_lights()
+static mutex_t core1_io_lock;
+static void core1_loop()
 {
-    uint64_t now = time_us_64();
-
-    if (now - last_hid_time >= 1000000) {
-        const uint32_t colors[] = {0x080808, 0x000080, 0x800000, 0x008000,
-                                0x008080, 0x808000, 0x800080};
-        for (int i = 0; i < air_num(); i++) {
-            int d = air_value(i);
-            rgb_set_color(i, colors[d]);
+    multicore_lockout_victim_init(); // parks here while flash is written
+    metrics_init();
+    while (1) {
+        metric_mark_t loop = metrics_mark();
+        if (mutex_try_enter(&core1_io_lock, NULL)) {
+            metric_mark_t m = metrics_mark();
+            lights_update();
+            m = metrics_lap(METRIC_LIGHTS, m);
+            rgb_update();
+            metrics_record(METRIC_LED, m);
+            mutex_exit(&core1_io_lock);
         }
+        metric_mark_t m = metrics_mark();
+        slider_update();
+        metrics_record(METRIC_SLIDER, m);
+        sleep_us(100);
+        metrics_record(METRIC_LOOP1, loop);
+        metrics_count(METRIC_LOOPS1);
     }
 }
 
-void bridge_slider_port()
+static void check_activity()
 {
-    if (tud_cdc_n_available(1)) {
-        uint8_t buf[128];
-        int len = tud_cdc_n_read(1, buf, sizeof(buf));
-        if (len > 0) {
-            uart_write_blocking(SLIDER_UART, buf, len);
-        }
-    }
-    while (uart_is_readable(SLIDER_UART)) {
-        tud_cdc_n_write_char(1, uart_getc(SLIDER_UART));
-        tud_cdc_n_write_flush(1);
+    static uint32_t last_touch;
+    static uint8_t last_air;
+    uint32_t touch = slider_touch();
+    uint8_t air = air_bitmap();
+    if ((touch != last_touch) || (air != last_air)) {
+        last_touch = touch;
+        last_air = air;
+        save_activity();
     }
 }
 
-static mutex_t core1_io_lock;
-static void core1_loop()
+/* Hold the first two buttons together to step through profiles */
+#define PROFILE_HOLD_US 2000000
+static void check_profile_switch()
 {
-    while (1) {
-        if (mutex_try_enter(&core1_io_lock, NULL)) {
-            run_lights();
-            rgb_update();
-            mutex_exit(&core1_io_lock);
-        }
-        cli_fps_count(1);
-        bridge_slider_port();
-        sleep_us(100);
+    static uint64_t hold_time = 0;
+    if (!button_pressed(0) || !button_pressed(1)) {
+        hold_time = 0;
+        return;
+    }
+
+    uint64_t now = time_us_64();
+    if (hold_time == 0) {
+        hold_time = now;
+    } else if (now - hold_time >= PROFILE_HOLD_US) {
+        hold_time = now;
+        int id = (config_profile() + 1) % CONFIG_PROFILE_NUM;
+        config_profile_select(id);
+        printf("Profile %d: %s\n", id + 1, config_profile_name(id));
     }
 }
 
 static void core0_loop()
 {
     while(1) {
+        metric_mark_t loop = metrics_mark();
+        metric_mark_t m = loop;
+
         tud_task();
+        console_drain();
+        m = metrics_lap(METRIC_TUD, m);
 
         cli_run();
-        //aime_update();
+        m = metrics_lap(METRIC_CLI, m);
+        vendor_update();
+        m = metrics_lap(METRIC_VENDOR, m);
+        aime_update();
+        m = metrics_lap(METRIC_AIME, m);
     
         save_loop();
-        cli_fps_count(0);
+        m = metrics_lap(METRIC_SAVE, m);
 
         air_update();
+        check_activity();
+        check_profile_switch();
+        m = metrics_lap(METRIC_AIR, m);
 
         gen_joy_report();
         gen_nkro_report();
         report_usb_hid();
-    }
-}
+        metrics_record(METRIC_REPORT, m);
 
-void slider_init()
-{
-    // init uart for slider port
-    gpio_set_function(SLIDER_TX, GPIO_FUNC_UART);
-    gpio_set_function(SLIDER_RX, GPIO_FUNC_UART);
-    gpio_pull_up(SLIDER_TX);
-    gpio_pull_up(SLIDER_RX);
-    uart_init(SLIDER_UART, 115200);
+        metrics_record(METRIC_LOOP0, loop);
+        metrics_count(METRIC_LOOPS0);
+    }
 }
 
 void update_check()
@@ -219,12 +249,15 @@ void init()
 
     tusb_init();
     stdio_init_all();
+    console_init();
 
+    metrics_init();
     config_init();
     mutex_init(&core1_io_lock);
     save_init(0xca341234, &core1_io_lock);
 
     air_init();
+    aime_init();
     rgb_init();
     button_init();
     slider_init();
@@ -233,6 +266,7 @@ void init()
                             " https://github.com/whowechina\n\n");
 
     commands_init();
+    vendor_init();
 }
 
 int main(void)
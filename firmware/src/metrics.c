@@ -0,0 +1,178 @@
+/*
+ * Loop Stage Timing and Counters
+ * WHowe <github.com/whowechina>
+ *
+ * Stage times are kept in a log-linear histogram, 4 steps per octave, so
+ * percentiles come out within ~12% at a fixed small cost per sample.
+ */
+
+#include "metrics.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+#define BUCKET_NUM 124
+#define LONG_US 50000 // beyond this SysTick may have wrapped
+
+static const char *stage_names[METRIC_STAGE_NUM] = {
+    "tud", "cli", "vendor", "aime", "save", "air", "report", "loop0",
+    "lights", "led", "slider", "loop1",
+};
+
+static const char *counter_names[METRIC_COUNTER_NUM] = {
+    "loops0", "loops1", "hid_reports",
+};
+
+static struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t hist[BUCKET_NUM];
+} stages[METRIC_STAGE_NUM];
+
+static struct {
+    uint32_t total;
+    uint32_t mark; // total at the start of the second
+    uint32_t rate;
+    uint32_t time;
+} counters[METRIC_COUNTER_NUM];
+
+static uint32_t cycles_per_us;
+
+void metrics_init()
+{
+    cycles_per_us = clock_get_hz(clk_sys) / 1000000;
+    systick_hw->rvr = 0x00ffffff;
+    systick_hw->cvr = 0;
+    systick_hw->csr = 0x5; // enabled, processor clock, no interrupt
+}
+
+static inline int bucket_of(uint32_t cycles)
+{
+    if (cycles < 4) {
+        return cycles;
+    }
+    int msb = 31 - __builtin_clz(cycles);
+    return (msb - 1) * 4 + ((cycles >> (msb - 2)) & 3);
+}
+
+static inline uint32_t bucket_value(int bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    int msb = bucket / 4 + 1;
+    uint32_t low = (4u + bucket % 4) << (msb - 2);
+    return low + (1u << (msb - 2)) / 2;
+}
+
+void metrics_record(metric_stage_t stage, metric_mark_t since)
+{
+    metric_mark_t now = metrics_mark();
+    uint32_t us = now.us - since.us;
+    uint32_t cycles = us < LONG_US ? (since.tick - now.tick) & 0x00ffffff
+                                   : us * cycles_per_us;
+
+    typeof(stages[0]) *s = &stages[stage];
+    if ((s->count == 0) || (cycles < s->min)) {
+        s->min = cycles;
+    }
+    if (cycles > s->max) {
+        s->max = cycles;
+    }
+    s->count++;
+    s->sum += cycles;
+
+    uint16_t *hist = s->hist;
+    int bucket = bucket_of(cycles);
+    if (hist[bucket] == 0xffff) {
+        for (int i = 0; i < BUCKET_NUM; i++) {
+            hist[i] /= 2; // keeps the shape
+        }
+    }
+    hist[bucket]++;
+}
+
+void metrics_count(metric_counter_t counter)
+{
+    typeof(counters[0]) *c = &counters[counter];
+    c->total++;
+
+    uint32_t now = time_us_32();
+    if (now - c->time >= 1000000) {
+        c->rate = c->total - c->mark;
+        c->mark = c->total;
+        c->time = now;
+    }
+}
+
+const char *metrics_stage_name(metric_stage_t stage)
+{
+    return stage_names[stage];
+}
+
+const char *metrics_counter_name(metric_counter_t counter)
+{
+    return counter_names[counter];
+}
+
+static uint32_t percentile(const uint16_t *hist, uint32_t total, int pct)
+{
+    uint32_t target = (total * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        seen += hist[i];
+        if (seen >= target) {
+            return bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+void metrics_summary(metric_stage_t stage, metric_summary_t *summary)
+{
+    typeof(stages[0]) *s = &stages[stage];
+    memset(summary, 0, sizeof(*summary));
+    if (s->count == 0) {
+        return;
+    }
+
+    summary->count = s->count;
+    summary->min = s->min;
+    summary->max = s->max;
+    summary->avg = s->sum / s->count;
+
+    uint32_t total = 0;
+    for (int i = 0; i < BUCKET_NUM; i++) {
+        total += s->hist[i];
+    }
+    summary->p50 = percentile(s->hist, total, 50);
+    summary->p90 = percentile(s->hist, total, 90);
+    summary->p99 = percentile(s->hist, total, 99);
+}
+
+uint32_t metrics_rate(metric_counter_t counter)
+{
+    return counters[counter].rate;
+}
+
+uint32_t metrics_total(metric_counter_t counter)
+{
+    return counters[counter].total;
+}
+
+uint32_t metrics_cycles_per_us()
+{
+    return cycles_per_us;
+}
+
+/* The other core may be halfway through a sample, one odd sample is fine */
+void metrics_reset()
+{
+    memset(stages, 0, sizeof(stages));
+}
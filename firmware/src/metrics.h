@@ -0,0 +1,81 @@
+/*
+ * Loop Stage Timing and Counters
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "hardware/structs/systick.h"
+#include "hardware/structs/timer.h"
+
+/* Each stage is only timed by one core, no locking needed */
+typedef enum {
+    METRIC_TUD = 0,
+    METRIC_CLI,
+    METRIC_VENDOR,
+    METRIC_AIME,
+    METRIC_SAVE,
+    METRIC_AIR,
+    METRIC_REPORT,
+    METRIC_LOOP0,
+    METRIC_LIGHTS,
+    METRIC_LED,
+    METRIC_SLIDER,
+    METRIC_LOOP1,
+    METRIC_STAGE_NUM,
+} metric_stage_t;
+
+typedef enum {
+    METRIC_LOOPS0 = 0,
+    METRIC_LOOPS1,
+    METRIC_HID_REPORTS,
+    METRIC_COUNTER_NUM,
+} metric_counter_t;
+
+/* SysTick counts cpu cycles down, 24 bits, the us timer covers the wraps */
+typedef struct {
+    uint32_t tick;
+    uint32_t us;
+} metric_mark_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min; // cycles
+    uint32_t max;
+    uint32_t avg;
+    uint32_t p50;
+    uint32_t p90;
+    uint32_t p99;
+} metric_summary_t;
+
+void metrics_init(); // on each core, starts its SysTick
+
+static inline metric_mark_t metrics_mark()
+{
+    return (metric_mark_t) { systick_hw->cvr, timer_hw->timerawl };
+}
+
+void metrics_record(metric_stage_t stage, metric_mark_t since);
+
+/* records since, returns a new mark for the next stage */
+static inline metric_mark_t metrics_lap(metric_stage_t stage, metric_mark_t since)
+{
+    metrics_record(stage, since);
+    return metrics_mark();
+}
+
+void metrics_count(metric_counter_t counter);
+
+const char *metrics_stage_name(metric_stage_t stage);
+const char *metrics_counter_name(metric_counter_t counter);
+void metrics_summary(metric_stage_t stage, metric_summary_t *summary);
+uint32_t metrics_rate(metric_counter_t counter); // per second
+uint32_t metrics_total(metric_counter_t counter);
+uint32_t metrics_cycles_per_us();
+void metrics_reset();
+
+#endif
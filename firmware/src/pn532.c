@@ -2,6 +2,11 @@
  * PN532 NFC Reader
  * WHowe <github.com/whowechina>
  *
+ * Every command runs through a small state machine, each step is a short I2C
+ * transfer (the frame read only once the status byte says ready) and nothing
+ * sleeps. The *_async() calls advance it and return PN532_BUSY until the
+ * command is finished, blocking calls just spin on them. Frames themselves
+ * are in pn532_frame.c.
  */
 
 #include <stdint.h>
@@ -14,18 +19,16 @@
 //#define DEBUG
 
 #include "pn532.h"
+#include "pn532_frame.h"
 #include "board_defs.h"
+#include "trace.h"
 
 #define IO_TIMEOUT_US 1000
 #define PN532_I2C_ADDRESS 0x24
 
-#define PN532_PREAMBLE 0
-#define PN532_STARTCODE1 0
-#define PN532_STARTCODE2 0xff
-#define PN532_POSTAMBLE 0
-
-#define PN532_HOSTTOPN532 0xd4
-#define PN532_PN532TOHOST 0xd5
+#define ACK_TIMEOUT_US 10000
+#define RESP_TIMEOUT_US 50000
+#define READY_POLL_US 500 // don't hog the bus checking ready status
 
 void pn532_init()
 {
@@ -36,220 +39,293 @@ void pn532_init()
     gpio_pull_up(I2C_SCL);
 }
 
-static int pn532_write(const uint8_t *data, uint8_t len)
+static uint32_t io_errors;
+
+uint32_t pn532_errors()
 {
-    return i2c_write_blocking_until(I2C_PORT, PN532_I2C_ADDRESS, data, len, false,
-                             time_us_64() + IO_TIMEOUT_US * len);
+    return io_errors;
 }
 
-static int pn532_read(uint8_t *data, uint8_t len)
+static int pn532_write(const uint8_t *data, int len)
 {
-    return i2c_read_blocking_until(I2C_PORT, PN532_I2C_ADDRESS, data, len, false,
-                            time_us_64() + IO_TIMEOUT_US * len);
+    int ret = i2c_write_blocking_until(I2C_PORT, PN532_I2C_ADDRESS, data, len, false,
+                                       time_us_64() + IO_TIMEOUT_US * len);
+    if (ret < 0) {
+        io_errors++;
+    }
+    return ret;
 }
 
-static bool pn532_wait_ready()
+static int pn532_read(uint8_t *data, int len)
 {
-    uint8_t status = 0;
-
-    for (int retry = 0; retry < 20; retry++) {
-        if (pn532_read(&status, 1) == 1 && status == 0x01) {
-            return true;
-        }
-        sleep_us(1000);
+    int ret = i2c_read_blocking_until(I2C_PORT, PN532_I2C_ADDRESS, data, len, false,
+                                      time_us_64() + IO_TIMEOUT_US * len);
+    if (ret < 0) {
+        io_errors++;
     }
+    return ret;
+}
 
-    return false;
+/* One buffer for both directions, a command frame is built in place and
+   sent from it, then the answer is read into it (after the I2C ready byte)
+   and checked in place. */
+static uint8_t io_buf[1 + PN532_FRAME_MAX];
+#define TX_PARAM (io_buf + PN532_FRAME_PARAM)
+
+static const uint8_t *readbuf; // response data, points into io_buf
+
+/* Just the I2C status byte, 1 if a frame is ready, 0 if not, -1 on error */
+static int read_ready()
+{
+    uint8_t status;
+    if (pn532_read(&status, 1) != 1) {
+        return -1;
+    }
+    return (status & 0x01) ? 1 : 0;
 }
 
-static int read_frame(uint8_t *frame, uint8_t len)
+/* Returns -1 on I2C error, 0 if not ready, the frame is at io_buf + 1 */
+static int read_frame(int len)
 {
-    uint8_t buf[len + 1];
-    int ret = pn532_read(buf, len + 1);
+    int ret = pn532_read(io_buf, len + 1);
 
 #ifdef DEBUG
     printf("I2C data read: %d -", ret);
     for (int i = 0; i < len + 1; i++) {
-        printf(" %02x", buf[i]);
+        printf(" %02x", io_buf[i]);
     }
     printf("\n");
 #endif
 
-    if (ret == len + 1) {
-        memcpy(frame, buf + 1, len);
-        return len;
+    if (ret != len + 1) {
+        return -1;
     }
-    return ret;
+    if (io_buf[0] != 0x01) {
+        return 0; // not ready
+    }
+    return len;
 }
 
-static int write_frame(const uint8_t *frame, uint8_t len)
+static int write_frame(int len)
 {
     #ifdef DEBUG
         printf("I2C frame write: %d -", len);
         for (int i = 0; i < len; i++) {
-            printf(" %02x", frame[i]);
+            printf(" %02x", io_buf[i]);
         }
         printf("\n");
     #endif
 
-    return pn532_write(frame, len);
+    return pn532_write(io_buf, len);
 }
 
-static bool read_ack()
+enum {
+    ST_IDLE = 0,
+    ST_SEND,
+    ST_ACK,
+    ST_RESP,
+};
+
+static struct {
+    uint8_t state;
+    uint8_t cmd;
+    uint8_t owner;
+    int frame_len;
+    int resp_len; // the most a response can take, read in one go
+    uint32_t timeout_us;
+    uint64_t deadline;
+    uint64_t next_poll;
+    struct {
+        uint8_t first;
+        uint8_t done;
+    } read; // multi-block MIFARE read in progress
+} job;
+
+static bool job_ready_poll(uint64_t now)
 {
-    uint8_t resp[6];
-
-    if (!pn532_wait_ready()) {
+    if (now < job.next_poll) {
         return false;
     }
-
-    read_frame(resp, 6);
-
-    const uint8_t expect_ack[] = {0, 0, 0xff, 0, 0xff, 0};
-    if (memcmp(resp, expect_ack, 6) != 0) {
-        return false;
-    }
-   
+    job.next_poll = now + READY_POLL_US;
     return true;
 }
 
-int pn532_write_data(const uint8_t *data, uint8_t len)
+static int job_fail()
 {
-    uint8_t frame[5 + len];
-    frame[0] = PN532_PREAMBLE;
-    frame[1] = PN532_STARTCODE1;
-    frame[2] = PN532_STARTCODE2;
-    uint8_t checksum = 0xff;
+    TRACE_END(TRACE_PN532, job.cmd);
+    job.state = ST_IDLE;
+    job.read.done = 0;
+    return PN532_FAIL;
+}
 
-    frame[3] = len;
-    frame[4] = (~len + 1);
+static void send_ack()
+{
+    /* an ACK from host aborts whatever PN532 is doing */
+    pn532_write(pn532_ack_frame, PN532_ACK_LEN);
+}
 
-    for (int i = 0; i < len; i++) {
-        frame[5 + i] = data[i];
-        checksum += data[i];
+static int job_not_ready(uint64_t now)
+{
+    if (now <= job.deadline) {
+        return PN532_BUSY;
     }
-
-    frame[5 + len] = ~checksum;
-    frame[6 + len] = PN532_POSTAMBLE;
-
-    write_frame(frame, 7 + len);
-
-    return read_ack();
+    send_ack();
+    return job_fail();
 }
 
-int pn532_read_data(uint8_t *data, uint8_t len)
+/* Cheap status check while waiting, a whole frame is only read once ready */
+static int job_poll(uint64_t now, int len)
 {
-    uint8_t resp[len + 7];
-
-    read_frame(resp, len + 7);
-
-    if (resp[0] != PN532_PREAMBLE ||
-        resp[1] != PN532_STARTCODE1 ||
-        resp[2] != PN532_STARTCODE2) {
-        return -1;
+    if (!job_ready_poll(now)) {
+        return PN532_BUSY;
     }
-
-    uint8_t length = resp[3];
-    uint8_t length_check = length + resp[4];
-
-    if (length > len ||
-        length_check != 0 ||
-        resp[length + 6] != PN532_POSTAMBLE) {
-        return -1;
+    int ret = read_ready();
+    if (ret < 0) {
+        return job_fail();
     }
-
-    uint8_t checksum = 0;
-    for (int i = 0; i <= length; i++) {
-        data[i] = resp[5 + i];
-        checksum += resp[5 + i];
+    if (ret == 0) {
+        return job_not_ready(now);
     }
-
-    if (checksum != 0) {
-        return -1;
+    ret = read_frame(len);
+    if (ret < 0) {
+        return job_fail();
     }
-    
-    return length;
+    if (ret == 0) {
+        return job_not_ready(now);
+    }
+    return PN532_OK;
 }
 
-int pn532_write_command(uint8_t cmd, const uint8_t *param, uint8_t len)
+/* One status read, or one status read and one frame read, per call.
+   readbuf points at response data on success */
+static int job_step()
 {
-    uint8_t data[len + 2];
-    data[0] = PN532_HOSTTOPN532;
-    data[1] = cmd;
+    uint64_t now = time_us_64();
+
+    switch (job.state) {
+        case ST_SEND:
+            if (write_frame(job.frame_len) != job.frame_len) {
+                return job_fail();
+            }
+            job.state = ST_ACK;
+            job.deadline = now + ACK_TIMEOUT_US;
+            job.next_poll = now + READY_POLL_US;
+            return PN532_BUSY;
+
+        case ST_ACK: {
+            int ret = job_poll(now, PN532_ACK_LEN);
+            if (ret != PN532_OK) {
+                return ret;
+            }
+            if (!pn532_frame_is_ack(io_buf + 1)) {
+                return job_fail();
+            }
+            job.state = ST_RESP;
+            job.deadline = now + job.timeout_us;
+            return PN532_BUSY;
+        }
 
-    memcpy(data + 2, param, len);
+        case ST_RESP: {
+            int ret = job_poll(now, job.resp_len);
+            if (ret != PN532_OK) {
+                return ret;
+            }
+            job.state = ST_IDLE;
+            TRACE_END(TRACE_PN532, job.cmd);
+            ret = pn532_frame_parse(io_buf + 1, job.resp_len, job.cmd, &readbuf);
+            return ret < 0 ? PN532_FAIL : ret;
+        }
 
-    return pn532_write_data(data, len + 2);
+        default:
+            return job_fail();
+    }
 }
 
-static void write_nack()
+static uint8_t caller; // owner of the *_async() calls being made
+
+void pn532_set_owner(uint8_t owner)
 {
-    const uint8_t nack[] = {0, 0, 0xff, 0xff, 0, 0};
-    pn532_write(nack, 6);
+    caller = owner;
 }
 
-int pn532_peak_response_len()
+bool pn532_busy()
 {
-    uint8_t buf[6];
-    if (!pn532_wait_ready()) {
-        return -1;
-    }
-    pn532_read(buf, 6);
-    if (buf[0] != 0x01 ||
-        buf[1] != PN532_PREAMBLE ||
-        buf[2] != PN532_STARTCODE1 ||
-        buf[3] != PN532_STARTCODE2) {
-        return -1;
-    }
-
-    write_nack();
-    return buf[4];
+    return job.state != ST_IDLE;
 }
 
-int pn532_read_response(uint8_t cmd, uint8_t *resp, uint8_t len)
+void pn532_abort()
 {
-    int real_len = pn532_peak_response_len();
-    if (real_len < 0) {
-        return -1;
+    if (job.state != ST_IDLE) {
+        send_ack();
+        job.state = ST_IDLE;
+        TRACE_END(TRACE_PN532, job.cmd);
     }
+    job.read.done = 0;
+}
 
-    if (!pn532_wait_ready()) {
-        return -1;
-    }
+/* Starts the command if idle, otherwise steps it. Params must already be at
+   TX_PARAM, resp_max is the most response data expected.
+   Returns PN532_BUSY, PN532_FAIL or the response length in readbuf. */
+static int transact_built(uint8_t cmd, uint8_t len, uint8_t resp_max,
+                          uint32_t timeout_us)
+{
+    if (job.state == ST_IDLE) {
+        if (len > 253) {
+            return PN532_FAIL;
+        }
+        job.cmd = cmd;
+        job.owner = caller;
+        job.frame_len = pn532_frame_build(io_buf, cmd, len);
+        job.resp_len = resp_max + 9; // 00 00 ff len lcs tfi cmd ... dcs 00
+        job.timeout_us = timeout_us;
+        job.state = ST_SEND;
+        TRACE_BEGIN(TRACE_PN532, cmd);
+    } else if ((job.owner != caller) || (job.cmd != cmd)) {
+        return PN532_FAIL; // someone else's command is running
+    }
+
+    return job_step();
+}
 
-    if (real_len < 2) {
-        return -1;
+static int transact(uint8_t cmd, const uint8_t *param, uint8_t len,
+                    uint8_t resp_max, uint32_t timeout_us)
+{
+    if ((job.state == ST_IDLE) && (len > 0) && (len <= 253)) {
+        memcpy(TX_PARAM, param, len);
     }
+    return transact_built(cmd, len, resp_max, timeout_us);
+}
 
-    uint8_t data[real_len];
-    int ret = pn532_read_data(data, real_len);
-    if (ret != real_len ||
-        data[0] != PN532_PN532TOHOST ||
-        data[1] != cmd + 1) {
-        return -1;
+int pn532_command_async(uint8_t cmd, const uint8_t *param, uint8_t len,
+                        uint8_t *resp, uint8_t resp_len)
+{
+    int ret = transact(cmd, param, len, resp_len, RESP_TIMEOUT_US);
+    if (ret < 0) {
+        return ret;
     }
-
-    int data_len = real_len - 2;
-    if (data_len > len) {
-        return -1;
+    if (ret > resp_len) {
+        return PN532_FAIL;
     }
-
-    if (data_len > 0) {
-        memcpy(resp, data + 2, data_len);
+    if (ret > 0) {
+        memcpy(resp, readbuf, ret);
     }
-
-    return data_len;
+    return ret;
 }
 
-uint32_t pn532_firmware_ver()
+int pn532_command(uint8_t cmd, const uint8_t *param, uint8_t len,
+                  uint8_t *resp, uint8_t resp_len)
 {
-    int ret = pn532_write_command(0x02, NULL, 0);
-    if (ret < 0) {
-        return 0;
+    int ret;
+    while ((ret = pn532_command_async(cmd, param, len, resp, resp_len)) == PN532_BUSY) {
+        tight_loop_contents();
     }
+    return ret;
+}
 
+uint32_t pn532_firmware_ver()
+{
     uint8_t ver[4];
-    int result = pn532_read_response(0x4a, ver, sizeof(ver));
+    int result = pn532_command(0x02, NULL, 0, ver, sizeof(ver));
     if (result < 4) {
         return 0;
     }
@@ -264,86 +340,86 @@ uint32_t pn532_firmware_ver()
 
 bool pn532_config_rf()
 {
-    uint8_t param[] = {0x05, 0xff, 0x01, 0x50};
-    pn532_write_command(0x32, param, sizeof(param));
-
-    return pn532_read_response(0x32, param, sizeof(param)) == 0;
+    /* MaxRetries: ATR, PSL, passive activation (few so no-card returns fast) */
+    uint8_t param[] = {0x05, 0xff, 0x01, 0x01};
+    return pn532_command(0x32, param, sizeof(param), NULL, 0) == 0;
 }
 
 bool pn532_config_sam()
 {
     uint8_t param[] = {0x01, 0x14, 0x01};
-    pn532_write_command(0x14, param, sizeof(param));
-
-    return pn532_read_response(0x14, NULL, 0) == 0;
+    return pn532_command(0x14, param, sizeof(param), NULL, 0) == 0;
 }
 
-
-bool pn532_set_rf_field(uint8_t auto_rf, uint8_t on_off)
+int pn532_set_rf_field_async(uint8_t auto_rf, uint8_t on_off)
 {
     uint8_t param[] = { 1, auto_rf | on_off };
-    pn532_write_command(0x32, param, 2);
-
-    return pn532_read_response(0x32, NULL, 0) >= 0;
+    int ret = transact(0x32, param, 2, 0, RESP_TIMEOUT_US);
+    return ret < 0 ? ret : PN532_OK;
 }
 
-static uint8_t readbuf[255];
+bool pn532_set_rf_field(uint8_t auto_rf, uint8_t on_off)
+{
+    int ret;
+    while ((ret = pn532_set_rf_field_async(auto_rf, on_off)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
 
-bool pn532_poll_mifare(uint8_t *uid, int *len)
+static int poll_uid(const uint8_t *param, uint8_t len, uint8_t *uid, int *uid_len)
 {
-    uint8_t param[] = {0x01, 0x00};
-    int ret = pn532_write_command(0x4a, param, sizeof(param));
-    if (ret < 0) {
-        return false;
+    int result = transact(0x4a, param, len, 6 + *uid_len, RESP_TIMEOUT_US);
+    if (result < 0) {
+        return result;
     }
 
-    int result = pn532_read_response(0x4a, readbuf, sizeof(readbuf));
     if (result < 1 || readbuf[0] != 1) {
-        return false;
+        return PN532_FAIL;
     }
 
     if (result != readbuf[5] + 6) {
-        return false;
+        return PN532_FAIL;
     }
 
-    if (*len < readbuf[5]) {
-        return false;
+    if (*uid_len < readbuf[5]) {
+        return PN532_FAIL;
     }
 
     memcpy(uid, readbuf + 6, readbuf[5]);
-    *len = readbuf[5];
+    *uid_len = readbuf[5];
 
-    return true;
+    return PN532_OK;
 }
 
-bool pn532_poll_14443b(uint8_t *uid, int *len)
+int pn532_poll_mifare_async(uint8_t *uid, int *len)
 {
-    uint8_t param[] = {0x01, 0x03, 0x00};
-    int ret = pn532_write_command(0x4a, param, sizeof(param));
-    if (ret < 0) {
-        return false;
-    }
+    static const uint8_t param[] = {0x01, 0x00};
+    return poll_uid(param, sizeof(param), uid, len);
+}
 
-    int result = pn532_read_response(0x4a, readbuf, sizeof(readbuf));
-    if (result < 1 || readbuf[0] != 1) {
-        printf("result: %d\n", result);
-        return false;
+bool pn532_poll_mifare(uint8_t *uid, int *len)
+{
+    int ret;
+    while ((ret = pn532_poll_mifare_async(uid, len)) == PN532_BUSY) {
+        tight_loop_contents();
     }
+    return ret == PN532_OK;
+}
 
-    if (result != readbuf[5] + 6) {
-        printf("result: %d %d\n", result, readbuf[5]);
-        return false;
-    }
+int pn532_poll_14443b_async(uint8_t *uid, int *len)
+{
+    static const uint8_t param[] = {0x01, 0x03, 0x00};
+    return poll_uid(param, sizeof(param), uid, len);
+}
 
-    if (*len < readbuf[5]) {
-        printf("result: %d %d\n", result, readbuf[5]);
-        return false;
+bool pn532_poll_14443b(uint8_t *uid, int *len)
+{
+    int ret;
+    while ((ret = pn532_poll_14443b_async(uid, len)) == PN532_BUSY) {
+        tight_loop_contents();
     }
-
-    memcpy(uid, readbuf + 6, readbuf[5]);
-    *len = readbuf[5];
-
-    return true;
+    return ret == PN532_OK;
 }
 
 static struct __attribute__((packed)) {
@@ -353,24 +429,23 @@ static struct __attribute__((packed)) {
     uint8_t inlist_tag;
 } felica_poll_cache;
 
-bool pn532_poll_felica(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache)
+int pn532_poll_felica_async(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache)
 {
     if (from_cache) {
         memcpy(uid, felica_poll_cache.idm, 8);
         memcpy(pmm, felica_poll_cache.pmm, 8);
         memcpy(syscode, felica_poll_cache.syscode, 2);
-        return true;
+        return PN532_OK;
     }
 
-    uint8_t param[] = { 1, 1, 0, 0xff, 0xff, 1, 0};
-    int ret = pn532_write_command(0x4a, param, sizeof(param));
-    if (ret < 0) {
-        return false;
+    static const uint8_t param[] = { 1, 1, 0, 0xff, 0xff, 1, 0};
+    int result = transact(0x4a, param, sizeof(param), 22, RESP_TIMEOUT_US);
+    if (result < 0) {
+        return result;
     }
 
-    int result = pn532_read_response(0x4a, readbuf, sizeof(readbuf));
     if (result != 22 || readbuf[0] != 1 || readbuf[2] != 20) {
-        return false;
+        return PN532_FAIL;
     }
 
     memcpy(&felica_poll_cache, readbuf + 4, 18);
@@ -380,118 +455,230 @@ bool pn532_poll_felica(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool
     memcpy(pmm, readbuf + 12, 8);
     memcpy(syscode, readbuf + 20, 2);
 
-    return true;
+    return PN532_OK;
 }
 
-bool pn532_mifare_auth(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key)
+bool pn532_poll_felica(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache)
+{
+    int ret;
+    while ((ret = pn532_poll_felica_async(uid, pmm, syscode, from_cache)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
+
+int pn532_mifare_auth_async(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key)
 {
     uint8_t param[] = { 1, key_id ? 1 : 0, block_id,
                        key[0], key[1], key[2], key[3], key[4], key[5],
                        uid[0], uid[1], uid[2], uid[3] };
-    int ret = pn532_write_command(0x40, param, sizeof(param));
-    if (ret < 0) {
-        printf("Failed mifare auth command\n");
-        return false;
+    int result = transact(0x40, param, sizeof(param), 1, RESP_TIMEOUT_US);
+    if (result < 0) {
+        return result;
     }
-    int result = pn532_read_response(0x40, readbuf, sizeof(readbuf));
-    if (readbuf[0] != 0) {
-        printf("PN532 Mifare AUTH failed %d %02x\n", result, readbuf[0]);
-        return false;
+
+    if (result < 1 || readbuf[0] != 0) {
+        printf("PN532 Mifare AUTH failed %d\n", result);
+        return PN532_FAIL;
     }
 
-    return true;
+    return PN532_OK;
 }
 
-bool pn532_mifare_read(uint8_t block_id, uint8_t block_data[16])
+bool pn532_mifare_auth(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key)
 {
-    uint8_t param[] = { 1, 0x30, block_id };
+    int ret;
+    while ((ret = pn532_mifare_auth_async(uid, block_id, key_id, key)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
 
-    int ret = pn532_write_command(0x40, param, sizeof(param));
-    if (ret < 0) {
-        printf("Failed mifare read command\n");
-        return false;
+/* Blocks of the authenticated sector, each READ goes out as soon as the
+   previous one is answered */
+int pn532_mifare_read_blocks_async(uint8_t block_id, uint8_t num, uint8_t *block_data)
+{
+    if ((job.state == ST_IDLE) && (job.read.first != block_id)) {
+        job.read.first = block_id; // not the read we were in the middle of
+        job.read.done = 0;
     }
 
-    int result = pn532_read_response(0x40, readbuf, sizeof(readbuf));
+    while (true) {
+        uint8_t param[] = { 1, 0x30, block_id + job.read.done };
 
-    if (readbuf[0] != 0 || result != 17) {
-        printf("PN532 Mifare READ failed %d %02x\n", result, readbuf[0]);
-        return false;
+        int result = transact(0x40, param, sizeof(param), 17, RESP_TIMEOUT_US);
+        if (result == PN532_BUSY) {
+            return result;
+        }
+
+        if (result != 17 || readbuf[0] != 0) {
+            printf("PN532 Mifare READ failed %d\n", result);
+            job.read.done = 0;
+            return PN532_FAIL;
+        }
+
+        memcpy(block_data + job.read.done * 16, readbuf + 1, 16);
+        job.read.done++;
+
+        if (job.read.done >= num) {
+            job.read.done = 0;
+            return PN532_OK;
+        }
     }
+}
 
-    memmove(block_data, readbuf + 1, 16);
+bool pn532_mifare_read_blocks(uint8_t block_id, uint8_t num, uint8_t *block_data)
+{
+    int ret;
+    while ((ret = pn532_mifare_read_blocks_async(block_id, num, block_data)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
 
-    return true;
+int pn532_mifare_read_async(uint8_t block_id, uint8_t block_data[16])
+{
+    return pn532_mifare_read_blocks_async(block_id, 1, block_data);
 }
 
-int pn532_felica_command(uint8_t cmd, const uint8_t *param, uint8_t param_len, uint8_t *outbuf)
+bool pn532_mifare_read(uint8_t block_id, uint8_t block_data[16])
+{
+    int ret;
+    while ((ret = pn532_mifare_read_async(block_id, block_data)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
+
+/* FeliCa frame built straight into the TX buffer, on success readbuf holds
+   status, length, response code, IDm and the rest of the reply */
+static int felica_exchange(uint8_t cmd, const uint8_t *param, uint8_t param_len,
+                           uint8_t resp_max)
 {
-    int cmd_len = param_len + 11;
-    uint8_t cmd_buf[cmd_len + 1];
+    uint8_t len = param_len + 10; // length byte, cmd, IDm and params
 
-    cmd_buf[0] = felica_poll_cache.inlist_tag;
-    cmd_buf[1] = cmd_len;
-    cmd_buf[2] = cmd;
-    memcpy(cmd_buf + 3, felica_poll_cache.idm, 8);
-    memcpy(cmd_buf + 11, param, param_len);
+    if ((job.state == ST_IDLE) && (param_len <= 253 - 11)) {
+        TX_PARAM[0] = felica_poll_cache.inlist_tag;
+        TX_PARAM[1] = len;
+        TX_PARAM[2] = cmd;
+        memcpy(TX_PARAM + 3, felica_poll_cache.idm, 8);
+        memcpy(TX_PARAM + 11, param, param_len);
+    }
 
-    int ret = pn532_write_command(0x40, cmd_buf, sizeof(cmd_buf));
-    if (ret < 0) {
-        printf("Failed send felica command\n");
-        return -1;
+    int result = transact_built(0x40, len + 1, resp_max, RESP_TIMEOUT_US);
+    if (result < 0) {
+        return result;
     }
 
-    int result = pn532_read_response(0x40, readbuf, sizeof(readbuf));
+    if ((result < 2) || (readbuf[0] & 0x3f) != 0 || result != readbuf[1] + 1) {
+        return PN532_FAIL;
+    }
 
-    int outlen = readbuf[1] - 1;
-    if ((readbuf[0] & 0x3f) != 0 || result - 2 != outlen) {
-        return -1;
+    return result;
+}
+
+int pn532_felica_command_async(uint8_t cmd, const uint8_t *param, uint8_t param_len, uint8_t *outbuf)
+{
+    int result = felica_exchange(cmd, param, param_len, 253);
+    if (result < 0) {
+        return result;
     }
 
-    memmove(outbuf, readbuf + 2, outlen);
+    int outlen = readbuf[1] - 1;
+    memcpy(outbuf, readbuf + 2, outlen);
 
     return outlen;
 }
 
+int pn532_felica_command(uint8_t cmd, const uint8_t *param, uint8_t param_len, uint8_t *outbuf)
+{
+    int ret;
+    while ((ret = pn532_felica_command_async(cmd, param, param_len, outbuf)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret;
+}
 
-bool pn532_felica_read_wo_encrypt(uint16_t svc_code, uint16_t block_id, uint8_t block_data[16])
+/* Several blocks of one service in a single Read Without Encryption */
+int pn532_felica_read_blocks_async(uint16_t svc_code, uint8_t num,
+                                   const uint16_t *block_ids, uint8_t *block_data)
 {
-    uint8_t param[] = { 1, svc_code & 0xff, svc_code >> 8,
-                        1, block_id >> 8, block_id & 0xff };
+    if ((num == 0) || (num > PN532_FELICA_READ_MAX)) {
+        return PN532_FAIL;
+    }
 
-    int result = pn532_felica_command(0x06, param, sizeof(param), readbuf);
+    uint8_t param[4 + PN532_FELICA_READ_MAX * 2] = { 1, svc_code & 0xff, svc_code >> 8, num };
+    for (int i = 0; i < num; i++) {
+        param[4 + i * 2] = block_ids[i] >> 8;
+        param[5 + i * 2] = block_ids[i] & 0xff;
+    }
 
-    if (result != 12 + 16 || readbuf[9] != 0 || readbuf[10] != 0) {
-        printf("PN532 Felica READ read failed %d %02x %02x\n",
-               result, readbuf[9], readbuf[10]);
-        for (int i = 0; i < result; i++) {
-            printf(" %02x", readbuf[i]);
-        }
-        printf("\n");
-        return false;
+    /* status, length, code, IDm, status flags, count, blocks */
+    int result = felica_exchange(0x06, param, 4 + num * 2, 14 + 16 * num);
+    if (result == PN532_BUSY) {
+        return result;
+    }
+
+    const uint8_t *out = readbuf + 2;
+    if (result != 14 + 16 * num || out[9] != 0 || out[10] != 0 || out[11] != num) {
+        printf("PN532 Felica READ read failed %d\n", result);
+        return PN532_FAIL;
     }
 
-    const uint8_t *result_data = readbuf + 12; 
-    memcpy(block_data, result_data, 16);
+    memcpy(block_data, out + 12, 16 * num);
 
-    return true;
+    return PN532_OK;
 }
 
-bool pn532_felica_write_wo_encrypt(uint16_t svc_code, uint16_t block_id, const uint8_t block_data[16])
+bool pn532_felica_read_blocks(uint16_t svc_code, uint8_t num,
+                              const uint16_t *block_ids, uint8_t *block_data)
+{
+    int ret;
+    while ((ret = pn532_felica_read_blocks_async(svc_code, num, block_ids, block_data)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
+
+int pn532_felica_read_wo_encrypt_async(uint16_t svc_code, uint16_t block_id, uint8_t block_data[16])
+{
+    return pn532_felica_read_blocks_async(svc_code, 1, &block_id, block_data);
+}
+
+bool pn532_felica_read_wo_encrypt(uint16_t svc_code, uint16_t block_id, uint8_t block_data[16])
+{
+    int ret;
+    while ((ret = pn532_felica_read_wo_encrypt_async(svc_code, block_id, block_data)) == PN532_BUSY) {
+        tight_loop_contents();
+    }
+    return ret == PN532_OK;
+}
+
+int pn532_felica_write_wo_encrypt_async(uint16_t svc_code, uint16_t block_id, const uint8_t block_data[16])
 {
     uint8_t param[22] = { 1, svc_code & 0xff, svc_code >> 8,
                         1, block_id >> 8, block_id & 0xff };
     memcpy(param + 6, block_data, 16);
-    int result = pn532_felica_command(0x08, param, sizeof(param), readbuf);
 
-    if (result < 0) {
+    uint8_t out[255]; // the card decides the response length
+    int result = pn532_felica_command_async(0x08, param, sizeof(param), out);
+    if (result == PN532_BUSY) {
+        return result;
+    }
+
+    if (result != 11 || out[9] != 0 || out[10] != 0) {
         printf("PN532 Felica WRITE failed %d\n", result);
-        return false;
+        return PN532_FAIL;
     }
 
-    for (int i = 0; i < result; i++) {
-        printf(" %02x", readbuf[i]);
+    return PN532_OK;
+}
+
+bool pn532_felica_write_wo_encrypt(uint16_t svc_code, uint16_t block_id, const uint8_t block_data[16])
+{
+    int ret;
+    while ((ret = pn532_felica_write_wo_encrypt_async(svc_code, block_id, block_data)) == PN532_BUSY) {
+        tight_loop_contents();
     }
-    printf("\n");
-    return false;
+    return ret == PN532_OK;
 }
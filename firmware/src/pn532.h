@@ -7,25 +7,68 @@
 #ifndef PN532_H
 #define PN532_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PN532_OK 0
+#define PN532_FAIL -1
+#define PN532_BUSY -2
+
 void pn532_init();
-int pn532_write_command(uint8_t cmd, const uint8_t *param, uint8_t len);
-int pn532_read_response(uint8_t cmd, uint8_t *resp, uint8_t len);
+
+/* Only one command at a time, keep calling an *_async() function with the
+   same arguments while it returns PN532_BUSY. While waiting, each call reads
+   just the 1-byte status, and it never sleeps. */
+bool pn532_busy();
+void pn532_abort();
+
+/* A command in flight belongs to the owner that started it. Set the owner
+   before the *_async() calls, any other owner gets PN532_FAIL until the
+   command is done. Owner 0 is the default. */
+void pn532_set_owner(uint8_t owner);
+uint32_t pn532_errors(); // failed I2C transfers
+
+int pn532_command_async(uint8_t cmd, const uint8_t *param, uint8_t len,
+                        uint8_t *resp, uint8_t resp_len);
+int pn532_command(uint8_t cmd, const uint8_t *param, uint8_t len,
+                  uint8_t *resp, uint8_t resp_len);
 
 uint32_t pn532_firmware_ver();
 
 bool pn532_config_sam();
 bool pn532_config_rf();
 
+int pn532_set_rf_field_async(uint8_t auto_rf, uint8_t on_off);
 bool pn532_set_rf_field(uint8_t auto_rf, uint8_t on_off);
 
+int pn532_poll_mifare_async(uint8_t *uid, int *len);
 bool pn532_poll_mifare(uint8_t *uid, int *len);
+int pn532_poll_14443b_async(uint8_t *uid, int *len);
 bool pn532_poll_14443b(uint8_t *uid, int *len);
+int pn532_poll_felica_async(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache);
 bool pn532_poll_felica(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache);
 
+int pn532_mifare_auth_async(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key);
 bool pn532_mifare_auth(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key);
+int pn532_mifare_read_async(uint8_t block_id, uint8_t block_data[16]);
 bool pn532_mifare_read(uint8_t block_id, uint8_t block_data[16]);
+/* num consecutive blocks after one auth, 16 bytes each */
+int pn532_mifare_read_blocks_async(uint8_t block_id, uint8_t num, uint8_t *block_data);
+bool pn532_mifare_read_blocks(uint8_t block_id, uint8_t num, uint8_t *block_data);
+
+int pn532_felica_command_async(uint8_t cmd, const uint8_t *param, uint8_t param_len, uint8_t *outbuf);
+int pn532_felica_command(uint8_t cmd, const uint8_t *param, uint8_t param_len, uint8_t *outbuf);
 
+int pn532_felica_read_wo_encrypt_async(uint16_t svc_code, uint16_t block_id, uint8_t block_data[16]);
 bool pn532_felica_read_wo_encrypt(uint16_t svc_code, uint16_t block_id, uint8_t block_data[16]);
+
+/* block_ids are 2-byte block list elements, up to PN532_FELICA_READ_MAX */
+#define PN532_FELICA_READ_MAX 12
+int pn532_felica_read_blocks_async(uint16_t svc_code, uint8_t num,
+                                   const uint16_t *block_ids, uint8_t *block_data);
+bool pn532_felica_read_blocks(uint16_t svc_code, uint8_t num,
+                              const uint16_t *block_ids, uint8_t *block_data);
+int pn532_felica_write_wo_encrypt_async(uint16_t svc_code, uint16_t block_id, const uint8_t block_data[16]);
 bool pn532_felica_write_wo_encrypt(uint16_t svc_code, uint16_t block_id, const uint8_t block_data[16]);
 
 #endif
@@ -0,0 +1,84 @@
+/*
+ * PN532 Frames
+ * WHowe <github.com/whowechina>
+ *
+ * Built and checked in place, no hardware dependency.
+ */
+
+#include "pn532_frame.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define PN532_PREAMBLE 0
+#define PN532_STARTCODE1 0
+#define PN532_STARTCODE2 0xff
+#define PN532_POSTAMBLE 0
+
+#define PN532_HOSTTOPN532 0xd4
+#define PN532_PN532TOHOST 0xd5
+
+const uint8_t pn532_ack_frame[PN532_ACK_LEN] = {0, 0, 0xff, 0, 0xff, 0};
+
+int pn532_frame_build(uint8_t *frame, uint8_t cmd, uint8_t len)
+{
+    uint8_t data_len = len + 2;
+    frame[0] = PN532_PREAMBLE;
+    frame[1] = PN532_STARTCODE1;
+    frame[2] = PN532_STARTCODE2;
+    frame[3] = data_len;
+    frame[4] = (~data_len + 1);
+    frame[5] = PN532_HOSTTOPN532;
+    frame[6] = cmd;
+
+    uint8_t checksum = 0;
+    for (int i = 5; i < 7 + len; i++) {
+        checksum += frame[i];
+    }
+
+    frame[7 + len] = ~checksum + 1;
+    frame[8 + len] = PN532_POSTAMBLE;
+
+    return 9 + len;
+}
+
+int pn532_frame_parse(const uint8_t *frame, int len, uint8_t cmd,
+                      const uint8_t **data)
+{
+    if (len < 9 ||
+        frame[0] != PN532_PREAMBLE ||
+        frame[1] != PN532_STARTCODE1 ||
+        frame[2] != PN532_STARTCODE2) {
+        return -1;
+    }
+
+    uint8_t length = frame[3];
+    uint8_t length_check = length + frame[4];
+
+    if (length < 2 ||
+        length + 7 > len ||
+        length_check != 0 ||
+        frame[length + 6] != PN532_POSTAMBLE ||
+        frame[5] != PN532_PN532TOHOST ||
+        frame[6] != (uint8_t)(cmd + 1)) {
+        return -1;
+    }
+
+    uint8_t checksum = 0;
+    for (int i = 0; i <= length; i++) {
+        checksum += frame[5 + i];
+    }
+
+    if (checksum != 0) {
+        return -1;
+    }
+
+    *data = frame + 7;
+    return length - 2;
+}
+
+bool pn532_frame_is_ack(const uint8_t *frame)
+{
+    return memcmp(frame, pn532_ack_frame, PN532_ACK_LEN) == 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * PN532 Frames
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PN532_FRAME_H
+#define PN532_FRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 00 00 ff len lcs tfi cmd data[len - 2] dcs 00 */
+#define PN532_FRAME_PARAM 7 // where the params of a command frame go
+#define PN532_FRAME_MAX (7 + 255 + 2)
+#define PN532_ACK_LEN 6
+
+extern const uint8_t pn532_ack_frame[PN532_ACK_LEN];
+
+/* Params must already be at frame + PN532_FRAME_PARAM, len up to 253.
+   Returns the frame length. */
+int pn532_frame_build(uint8_t *frame, uint8_t cmd, uint8_t len);
+
+/* Checks a response to cmd within len bytes, returns the data length and
+   points data into the frame, -1 if the frame is bad */
+int pn532_frame_parse(const uint8_t *frame, int len, uint8_t cmd,
+                      const uint8_t **data);
+
+bool pn532_frame_is_ack(const uint8_t *frame);
+
+#endif
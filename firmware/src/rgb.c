@@ -2,6 +2,11 @@
  * RGB LED (WS2812) Strip control
  * WHowe <github.com/whowechina>
  * 
+ * rgb_buf is the back buffer everyone paints into, in logical order. Each
+ * frame it's mapped through RGB_LAYOUT to the front buffer in chain order
+ * and DMA feeds the PIO from there, a completion interrupt tells when the
+ * strip can take the next frame. Only the chain up to the last changed
+ * segment is sent, LEDs behind it just keep their colors.
  */
 
 #include "rgb.h"
@@ -14,23 +19,63 @@
 #include "bsp/board.h"
 #include "hardware/pio.h"
 #include "hardware/timer.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "pico/critical_section.h"
 
 #include "ws2812.pio.h"
 
 #include "board_defs.h"
 #include "config.h"
+#include "rgb_lut.h"
+#include "trace.h"
 
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
-static uint32_t rgb_buf[47]; // 16(Keys) + 15(Gaps) + 16(maximum ToF indicators)
+static uint32_t rgb_buf[RGB_LOGICAL_NUM];
 
-#define _MAP_LED(x) _MAKE_MAPPER(x)
-#define _MAKE_MAPPER(x) MAP_LED_##x
-#define MAP_LED_RGB { c1 = r; c2 = g; c3 = b; }
-#define MAP_LED_GRB { c1 = g; c2 = r; c3 = b; }
+/* Temporal dithering: 4 more bits per channel, a full cycle is 16 frames */
+#define DITHER_MASK 0xf0
+#define DITHER_MASK_RGB (DITHER_MASK << 16 | DITHER_MASK << 8 | DITHER_MASK)
+static uint32_t rgb_frac[RGB_LOGICAL_NUM]; // fractions the LUT couldn't show
+static uint8_t dither_acc[RGB_LOGICAL_NUM][3];
 
-#define REMAP_BUTTON_RGB _MAP_LED(BUTTON_RGB_ORDER)
-#define REMAP_TT_RGB _MAP_LED(TT_RGB_ORDER)
+#define LED_TAIL_US 600 // PIO FIFO drain plus WS2812 reset, after DMA is done
+#define LED_REFRESH_US 1000000 // whole strip now and then, in case of glitches
+
+static const rgb_segment_t layout[] = RGB_LAYOUT;
+#define SEG_NUM ARRAY_SIZE(layout)
+
+static uint16_t seg_end[SEG_NUM]; // chain position after each segment
+static uint32_t seg_mask[RGB_LOGICAL_NUM]; // which segment shows the LED
+static volatile uint32_t dirty;
+
+static uint32_t led_frame[RGB_STRIP_LEN]; // front buffer, read by DMA
+static int led_dma;
+static volatile bool led_busy;
+static volatile uint64_t led_done_time;
+
+/* Host frames: core0 fills the back one, a commit swaps it to the front
+   under the lock, and core1 takes the front one into rgb_buf before its
+   next frame. Half written frames never show up. Colors are kept raw and
+   go through the LUT when taken. */
+static struct {
+    uint32_t buf[2][RGB_LOGICAL_NUM];
+    int back;
+    volatile bool ready; // front holds a frame not taken yet
+    critical_section_t lock;
+    uint64_t window;
+    uint32_t count;
+    rgb_host_stats_t stats;
+} host;
+
+static struct {
+    uint64_t last;
+    uint64_t refresh;
+    uint64_t window;
+    uint32_t count;
+    uint32_t fps;
+} frame_clock;
 
 static inline uint32_t _rgb32(uint32_t c1, uint32_t c2, uint32_t c3, bool gamma_fix)
 {
@@ -45,11 +90,7 @@ static inline uint32_t _rgb32(uint32_t c1, uint32_t c2, uint32_t c3, bool gamma_
 
 uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix)
 {
-#if BUTTON_RGB_ORDER == GRB
-    return _rgb32(g, r, b, gamma_fix);
-#else
     return _rgb32(r, g, b, gamma_fix);
-#endif
 }
 
 uint32_t rgb32_from_hsv(uint8_t h, uint8_t s, uint8_t v)
@@ -83,17 +124,51 @@ uint32_t rgb32_from_hsv(uint8_t h, uint8_t s, uint8_t v)
     }
 }
 
-static void drive_led()
+static void __isr led_dma_done()
 {
-    static uint64_t last = 0;
-    uint64_t now = time_us_64();
-    if (now - last < 4000) { // no faster than 250Hz
-        return;
+    dma_hw->ints0 = 1u << led_dma;
+    led_done_time = time_us_64();
+    led_busy = false;
+}
+
+static void count_fps(uint64_t now)
+{
+    frame_clock.count++;
+    if (now - frame_clock.window >= 1000000) {
+        frame_clock.fps = frame_clock.count;
+        frame_clock.count = 0;
+        frame_clock.window = now;
     }
-    last = now;
+}
 
-    for (int i = 0; i <= 12; i++) {
-        pio_sm_put_blocking(pio0, 0, rgb_buf[i] << 8u);
+static inline uint32_t wire_color(uint32_t color, uint8_t order)
+{
+    uint32_t r = (color >> 16) & 0xff;
+    uint32_t g = (color >> 8) & 0xff;
+    uint32_t b = color & 0xff;
+
+    switch (order) {
+        case RGB_ORDER_RBG:
+            return r << 16 | b << 8 | g;
+        case RGB_ORDER_GRB:
+            return g << 16 | r << 8 | b;
+        case RGB_ORDER_GBR:
+            return g << 16 | b << 8 | r;
+        case RGB_ORDER_BRG:
+            return b << 16 | r << 8 | g;
+        case RGB_ORDER_BGR:
+            return b << 16 | g << 8 | r;
+        default:
+            return color;
+    }
+}
+
+static inline void put_color(unsigned index, uint32_t color, uint32_t frac)
+{
+    if ((rgb_buf[index] != color) || (rgb_frac[index] != frac)) {
+        rgb_buf[index] = color;
+        rgb_frac[index] = frac;
+        dirty |= seg_mask[index];
     }
 }
 
@@ -105,20 +180,122 @@ void rgb_set_colors(const uint32_t *colors, unsigned index, size_t num)
     if (index + num > ARRAY_SIZE(rgb_buf)) {
         num = ARRAY_SIZE(rgb_buf) - index;
     }
-    memcpy(&rgb_buf[index], colors, num * sizeof(*colors));
+    for (int i = 0; i < num; i++) {
+        put_color(index + i, colors[i], 0);
+    }
 }
 
-static inline uint32_t apply_level(uint32_t color)
+/* Tables are rebuilt on first use after the settings change */
+static struct {
+    uint8_t level;
+    uint8_t gamma;
+    uint8_t white[3];
+    rgb_lut_t tables;
+} lut = { .level = 0xff, .gamma = 0xff };
+
+static inline void lut_check()
 {
-    unsigned r = (color >> 16) & 0xff;
-    unsigned g = (color >> 8) & 0xff;
-    unsigned b = color & 0xff;
+    if ((lut.level == chu_cfg->style.level) &&
+        (lut.gamma == chu_cfg->led.gamma) &&
+        (memcmp(lut.white, chu_cfg->led.white, 3) == 0)) {
+        return;
+    }
+    lut.level = chu_cfg->style.level;
+    lut.gamma = chu_cfg->led.gamma;
+    memcpy(lut.white, chu_cfg->led.white, 3);
+    rgb_lut_build(&lut.tables, lut.level, lut.gamma, lut.white);
+}
+
+static inline void put_lut(unsigned index, uint8_t r, uint8_t g, uint8_t b)
+{
+    uint32_t frac;
+    uint32_t color = rgb_lut_apply(&lut.tables, r, g, b, &frac);
+    put_color(index, color, frac & DITHER_MASK_RGB);
+}
 
-    r = r * chu_cfg->style.level / 255;
-    g = g * chu_cfg->style.level / 255;
-    b = b * chu_cfg->style.level / 255;
+/* front buffer for segments up to the last dirty one, returns chain length */
+static int compose_frame(uint32_t changed)
+{
+    int last = -1;
+    for (int i = 0; i < SEG_NUM; i++) {
+        if (changed & (1ul << i)) {
+            last = i;
+        }
+    }
+
+    int pos = 0;
+    for (int i = 0; i <= last; i++) {
+        const rgb_segment_t *seg = &layout[i];
+        unsigned first = seg->base + seg->first;
+        for (int j = 0; (j < seg->count) && (pos < seg_end[i]); j++) {
+            unsigned k = first + (seg->reverse ? seg->count - 1 - j : j);
+            uint32_t color = rgb_buf[k];
+            if (chu_cfg->led.dither) {
+                color = rgb_dither(dither_acc[k], color, rgb_frac[k]);
+            }
+            led_frame[pos++] = wire_color(color, seg->order) << 8u;
+        }
+    }
+
+    return pos;
+}
 
-    return r << 16 | g << 8 | b;
+static void take_host_frame()
+{
+    if (!host.ready) {
+        return;
+    }
+    critical_section_enter_blocking(&host.lock);
+    const uint32_t *front = host.buf[host.back ^ 1];
+    lut_check();
+    for (int i = 0; i < RGB_LOGICAL_NUM; i++) {
+        uint32_t c = front[i];
+        put_lut(i, (c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+    }
+    host.ready = false;
+    critical_section_exit(&host.lock);
+}
+
+static void drive_led()
+{
+    take_host_frame();
+
+    uint64_t now = time_us_64();
+    if (led_busy || (now - led_done_time < LED_TAIL_US) ||
+        (now - frame_clock.last < 1000000 / chu_cfg->led.fps)) {
+        return;
+    }
+
+    if (chu_cfg->led.dither ||
+        (now - frame_clock.refresh >= LED_REFRESH_US)) {
+        frame_clock.refresh = now;
+        dirty = (1ul << SEG_NUM) - 1; // dithering changes every frame
+    }
+
+    uint32_t changed = dirty;
+    if (!changed) {
+        return;
+    }
+    dirty = 0;
+    frame_clock.last = now;
+
+    int len = compose_frame(changed);
+    if (len == 0) {
+        return;
+    }
+
+    led_busy = true;
+    TRACE_INSTANT(TRACE_LED_FRAME, len);
+    dma_channel_transfer_from_buffer_now(led_dma, led_frame, len);
+    count_fps(now);
+}
+
+uint32_t rgb_fps()
+{
+    if (time_us_64() - frame_clock.window > 2000000) {
+        return 0; // stalled
+    }
+    return frame_clock.fps;
 }
 
 void rgb_set_color(unsigned index, uint32_t color)
@@ -126,7 +303,8 @@ void rgb_set_color(unsigned index, uint32_t color)
     if (index >= ARRAY_SIZE(rgb_buf)) {
         return;
     }
-    rgb_buf[index] = apply_level(color);
+    lut_check();
+    put_lut(index, (color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff);
 }
 
 void rgb_set_brg(unsigned index, const uint8_t *brg_array, size_t num)
@@ -137,20 +315,102 @@ void rgb_set_brg(unsigned index, const uint8_t *brg_array, size_t num)
     if (index + num > ARRAY_SIZE(rgb_buf)) {
         num = ARRAY_SIZE(rgb_buf) - index;
     }
-    for (int i = 0; i < num; i++) {
-        uint8_t b = brg_array[i * 3 + 0];
-        uint8_t r = brg_array[i * 3 + 1];
-        uint8_t g = brg_array[i * 3 + 2];
-        rgb_buf[index + i] = apply_level(rgb32(r, g, b, false));
+    lut_check();
+    const uint8_t *brg = brg_array;
+    for (int i = 0; i < num; i++, brg += 3) {
+        put_lut(index + i, brg[1], brg[2], brg[0]);
+    }
+}
+
+void rgb_host_write(unsigned index, const uint8_t *rgb, size_t num)
+{
+    if (index >= RGB_LOGICAL_NUM) {
+        return;
+    }
+    if (index + num > RGB_LOGICAL_NUM) {
+        num = RGB_LOGICAL_NUM - index;
+    }
+    uint32_t *back = host.buf[host.back] + index;
+    for (int i = 0; i < num; i++, rgb += 3) {
+        back[i] = rgb[0] << 16 | rgb[1] << 8 | rgb[2];
     }
 }
 
+void rgb_host_commit()
+{
+    critical_section_enter_blocking(&host.lock);
+    if (host.ready) {
+        host.stats.dropped++; // core1 didn't get to the previous one
+    }
+    host.back ^= 1;
+    host.ready = true;
+    critical_section_exit(&host.lock);
+
+    /* later writes may touch only part of the frame */
+    memcpy(host.buf[host.back], host.buf[host.back ^ 1], sizeof(host.buf[0]));
+
+    uint64_t now = time_us_64();
+    host.stats.frames++;
+    host.count++;
+    if (now - host.window >= 1000000) {
+        host.stats.fps = host.count;
+        host.count = 0;
+        host.window = now;
+    }
+}
+
+const rgb_host_stats_t *rgb_host_stats()
+{
+    if (time_us_64() - host.window > 2000000) {
+        host.stats.fps = 0;
+    }
+    return &host.stats;
+}
+
+bool rgb_mapped(unsigned index)
+{
+    return (index < RGB_LOGICAL_NUM) && seg_mask[index];
+}
+
+static void layout_init()
+{
+    int pos = 0;
+    for (int i = 0; i < SEG_NUM; i++) {
+        const rgb_segment_t *seg = &layout[i];
+        for (int j = 0; j < seg->count; j++) {
+            unsigned index = seg->base + seg->first + j;
+            if (index < RGB_LOGICAL_NUM) {
+                seg_mask[index] |= 1ul << i;
+            }
+        }
+        pos += seg->count;
+        seg_end[i] = pos < RGB_STRIP_LEN ? pos : RGB_STRIP_LEN;
+    }
+    dirty = (1ul << SEG_NUM) - 1;
+}
+
 void rgb_init()
 {
+    layout_init();
+    critical_section_init(&host.lock);
+
     uint pio0_offset = pio_add_program(pio0, &ws2812_program);
 
     gpio_set_drive_strength(RGB_PIN, GPIO_DRIVE_STRENGTH_2MA);
     ws2812_program_init(pio0, 0, pio0_offset, RGB_PIN, 800000, false);
+
+    led_dma = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(led_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio0, 0, true));
+    dma_channel_configure(led_dma, &c, &pio0->txf[0], led_frame,
+                          RGB_STRIP_LEN, false);
+
+    dma_channel_set_irq0_enabled(led_dma, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, led_dma_done);
+    irq_set_enabled(DMA_IRQ_0, true);
 }
 
 void rgb_update()
@@ -12,8 +12,46 @@
 
 #include "config.h"
 
+/* Logical LEDs, colors are always 0xRRGGBB here. Where they sit on the
+   strip is up to RGB_LAYOUT in board_defs.h, LEDs it doesn't map are never
+   sent out. */
+#define RGB_KEY_NUM 16
+#define RGB_GAP_NUM 15
+#define RGB_AIR_NUM 16
+
+#define RGB_KEY_BASE 0
+#define RGB_GAP_BASE (RGB_KEY_BASE + RGB_KEY_NUM)
+#define RGB_AIR_BASE (RGB_GAP_BASE + RGB_GAP_NUM)
+#define RGB_LOGICAL_NUM (RGB_AIR_BASE + RGB_AIR_NUM)
+
+enum {
+    RGB_SEG_KEY = RGB_KEY_BASE,
+    RGB_SEG_GAP = RGB_GAP_BASE,
+    RGB_SEG_AIR = RGB_AIR_BASE,
+};
+
+enum {
+    RGB_ORDER_RGB = 0,
+    RGB_ORDER_RBG,
+    RGB_ORDER_GRB,
+    RGB_ORDER_GBR,
+    RGB_ORDER_BRG,
+    RGB_ORDER_BGR,
+};
+
+/* A run of LEDs on the chain, in wiring order */
+typedef struct {
+    uint8_t base; // RGB_SEG_*
+    uint8_t first; // first logical LED within the segment
+    uint8_t count;
+    uint8_t order; // RGB_ORDER_*
+    bool reverse; // chain runs from the last logical LED back to the first
+} rgb_segment_t;
+
 void rgb_init();
 void rgb_update();
+uint32_t rgb_fps(); // achieved LED frame rate
+bool rgb_mapped(unsigned index); // the logical LED is on the strip
 
 uint32_t rgb32(uint32_t r, uint32_t g, uint32_t b, bool gamma_fix);
 uint32_t rgb32_from_hsv(uint8_t h, uint8_t s, uint8_t v);
@@ -24,4 +62,16 @@ void rgb_set_color(unsigned index, uint32_t color);
 /* num of the rgb leds, num*3 bytes in the array */
 void rgb_set_brg(unsigned index, const uint8_t *brg_array, size_t num);
 
+/* Host frames, RGB triples go to the back buffer and show up as a whole
+   after commit. Not for core1. */
+typedef struct {
+    uint32_t frames;
+    uint32_t dropped; // replaced before they were shown
+    uint32_t fps;
+} rgb_host_stats_t;
+
+void rgb_host_write(unsigned index, const uint8_t *rgb, size_t num);
+void rgb_host_commit();
+const rgb_host_stats_t *rgb_host_stats();
+
 #endif
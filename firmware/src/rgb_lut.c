@@ -0,0 +1,32 @@
+/*
+ * LED Colour Tables
+ * WHowe <github.com/whowechina>
+ *
+ * Pure pixel math, no hardware dependency. The dither step is inline in
+ * rgb_lut.h, it runs for every LED of every frame.
+ */
+
+#include "rgb_lut.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+
+static void build_channel(uint16_t *table, uint32_t level, bool gamma,
+                          uint32_t white)
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t v = i;
+        if (gamma) {
+            v = ((v + 1) * (v + 1) - 1) >> 8;
+        }
+        table[i] = (v * white * level * 256) / (255 * 255);
+    }
+}
+
+void rgb_lut_build(rgb_lut_t *lut, uint8_t level, bool gamma,
+                   const uint8_t white[3])
+{
+    build_channel(lut->r, level, gamma, white[0]);
+    build_channel(lut->g, level, gamma, white[1]);
+    build_channel(lut->b, level, gamma, white[2]);
+}
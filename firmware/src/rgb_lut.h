@@ -0,0 +1,57 @@
+/*
+ * LED Colour Tables
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef RGB_LUT_H
+#define RGB_LUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Level, gamma and white balance folded into one table per channel,
+   8.8 fixed point, the fraction is what dithering can bring back */
+typedef struct {
+    uint16_t r[256];
+    uint16_t g[256];
+    uint16_t b[256];
+} rgb_lut_t;
+
+void rgb_lut_build(rgb_lut_t *lut, uint8_t level, bool gamma,
+                   const uint8_t white[3]);
+
+/* 0xRRGGBB out, the 8 bit fractions of each channel go to *frac */
+static inline uint32_t rgb_lut_apply(const rgb_lut_t *lut, uint8_t r,
+                                     uint8_t g, uint8_t b, uint32_t *frac)
+{
+    uint32_t r16 = lut->r[r];
+    uint32_t g16 = lut->g[g];
+    uint32_t b16 = lut->b[b];
+    *frac = (r16 & 0xff) << 16 | (g16 & 0xff) << 8 | (b16 & 0xff);
+    return (r16 >> 8) << 16 | (g16 >> 8) << 8 | (b16 >> 8);
+}
+
+/* First order sigma-delta per channel: the fraction accumulates every frame
+   and bumps the channel by one step when it overflows. Over 256 frames the
+   average is the color plus frac / 256 per channel. */
+static inline uint32_t rgb_dither(uint8_t acc[3], uint32_t color, uint32_t frac)
+{
+    if (!frac) {
+        return color;
+    }
+
+    uint32_t out = 0;
+    for (int c = 0; c < 3; c++) {
+        int shift = 16 - c * 8;
+        uint32_t v = (color >> shift) & 0xff;
+        uint32_t sum = acc[c] + ((frac >> shift) & 0xff);
+        acc[c] = sum;
+        if ((sum > 0xff) && (v < 0xff)) {
+            v++;
+        }
+        out |= v << shift;
+    }
+    return out;
+}
+
+#endif
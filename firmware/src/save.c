@@ -1,8 +1,11 @@
 /*
  * Controller Config Save and Load
  * WHowe <github.com/whowechina>
- * 
- * Config is stored in last sector of flash
+ *
+ * Config is kept in an append-only journal in the last sectors of flash.
+ * Each sector starts with a header and a full snapshot, then delta records
+ * of changed module regions follow. Only the sector with the highest
+ * sequence number matters, when it fills up the next one takes over.
  */
 
 #include "save.h"
@@ -10,6 +13,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <memory.h>
 
 
@@ -21,6 +25,10 @@
 #include "pico/multicore.h"
 #include "pico/unique_id.h"
 
+#include "trace.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 static struct {
     size_t size;
     size_t offset;
@@ -30,77 +38,433 @@ static int module_num = 0;
 
 static uint32_t my_magic = 0xcafecafe;
 
-#define SAVE_TIMEOUT_US 5000000
+#define SAVE_COALESCE_US 5000000 // quiet time after the latest change
+#define SAVE_INTERVAL_US 30000000 // at least this between flash writes
+#define SAVE_IDLE_US 3000000 // no input activity for this long
+#define SAVE_MAX_DEFER_US 600000000 // write anyway after waiting this long
+
+#define SAVE_DATA_SIZE 1024
+#define SAVE_SECTORS 4
+#define SAVE_BASE_OFFSET (PICO_FLASH_SIZE_BYTES - SAVE_SECTORS * FLASH_SECTOR_SIZE)
 
-#define SAVE_SECTOR_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+/* old format, one page per save in the last sector */
+#define LEGACY_SECTOR_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define LEGACY_DATA_SIZE 63 // the config as it was, the only region back then
 
-typedef struct __attribute ((packed)) {
+#define JOURNAL_TAG 0x4c4e524a // "JRNL"
+#define RECORD_KIND 0x5a01 // the last, or only, record of a save
+#define RECORD_MORE 0x5a02 // more records of the same save follow
+#define RECORD_ERASED 0xffff
+
+typedef struct __attribute__((packed)) {
     uint32_t magic;
-    uint8_t data[FLASH_PAGE_SIZE - 4];
-} page_t;
+    uint32_t tag;
+    uint32_t seq;
+    uint32_t erases; // lifetime sector erases, wear counter
+    uint16_t size; // image size of the snapshot
+    uint16_t crc;
+} sector_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t kind;
+    uint16_t offset;
+    uint16_t len;
+    uint16_t crc; // over kind, offset, len and data
+} record_hdr_t;
+
+#define RECORD_ALIGN(n) (((n) + 3) & ~3u)
 
-static page_t old_data = {0};
-static page_t new_data = {0};
-static page_t default_data = {0};
-static int data_page = -1;
+typedef struct {
+    uint8_t data[SAVE_DATA_SIZE];
+} image_t;
 
-static bool requesting_save = false;
-static uint64_t requesting_time = 0;
+/* Snapshot: header, all regions back to back, CRC16 (LE) of both */
+#define SNAPSHOT_VERSION 1
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic; // config schema, same as the journal's
+    uint16_t version;
+    uint16_t size; // data bytes after the header
+    uint8_t module_num;
+    uint8_t rsvd;
+    uint16_t module_size[8];
+} snapshot_hdr_t;
+
+static image_t old_data = {0};
+static image_t new_data = {0};
+static image_t default_data = {0};
+static size_t data_size = 0;
+
+static struct {
+    int sector; // -1: no journal yet
+    uint32_t seq;
+    uint32_t pos; // append position within the sector
+    bool torn; // a broken record at the tail, start a new sector
+    bool spare_erased; // next sector is ready for rollover
+    uint32_t records;
+    uint32_t erases;
+} journal = { .sector = -1 };
+
+static struct {
+    bool pending;
+    bool urgent; // asked for explicitly, no coalescing or interval
+    uint64_t first; // first request of the batch
+    uint64_t last; // latest request of the batch
+    uint64_t last_write;
+    uint64_t last_activity;
+    uint32_t writes;
+} sched;
+
+static save_stats_t stats;
 
 static mutex_t *io_lock;
 
-static void save_program()
+static struct {
+    uint64_t start;
+    uint32_t last; // us, other core parked and interrupts held off
+    uint32_t max;
+} stall;
+
+static uint16_t crc16(uint16_t crc, const void *data, size_t len)
 {
-    old_data = new_data;
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i] << 8;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
 
-    data_page = (data_page + 1) % (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE);
-    printf("\nProgram Flash %d %8lx\n", data_page, old_data.magic);
-    if (mutex_enter_timeout_us(io_lock, 100000)) {
-        sleep_ms(10); /* wait for all io operations to finish */
-        uint32_t ints = save_and_disable_interrupts();
-        if (data_page == 0) {
-            flash_range_erase(SAVE_SECTOR_OFFSET, FLASH_SECTOR_SIZE);
+static uint32_t sector_offset(int sector)
+{
+    return SAVE_BASE_OFFSET + sector * FLASH_SECTOR_SIZE;
+}
+
+static const uint8_t *flash_ptr(uint32_t offset)
+{
+    return (const uint8_t *)(XIP_BASE + offset);
+}
+
+static uint16_t record_crc(const record_hdr_t *rec, const uint8_t *data)
+{
+    uint16_t crc = crc16(0xffff, rec, offsetof(record_hdr_t, crc));
+    return crc16(crc, data, rec->len);
+}
+
+/* core1 finishes its LED frame, then parks in the SDK's RAM resident
+   lockout handler, so nothing runs from XIP while flash is busy. Slider
+   RX and LED output keep going by DMA from SRAM meanwhile. */
+static bool flash_begin()
+{
+    if (!mutex_enter_timeout_us(io_lock, 100000)) {
+        printf("Program Flash Failed.\n");
+        return false;
+    }
+    stall.start = time_us_64();
+    if (multicore_lockout_victim_is_initialized(1) &&
+        !multicore_lockout_start_timeout_us(100000)) {
+        mutex_exit(io_lock);
+        printf("Program Flash Failed, core1 lockout.\n");
+        return false;
+    }
+    return true;
+}
+
+static void flash_end()
+{
+    if (multicore_lockout_victim_is_initialized(1)) {
+        multicore_lockout_end_blocking();
+    }
+    stall.last = time_us_64() - stall.start;
+    if (stall.last > stall.max) {
+        stall.max = stall.last;
+    }
+    mutex_exit(io_lock);
+}
+
+static void flash_erase(int sector)
+{
+    journal.erases++;
+    TRACE_BEGIN(TRACE_FLASH_ERASE, sector);
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(sector_offset(sector), FLASH_SECTOR_SIZE);
+    restore_interrupts(ints);
+    TRACE_END(TRACE_FLASH_ERASE, sector);
+}
+
+/* NOR flash only clears bits, so 0xff pads leave neighbours untouched */
+static void flash_write(uint32_t offset, const void *data, size_t len)
+{
+    static uint8_t page[FLASH_PAGE_SIZE];
+    const uint8_t *src = data;
+    while (len > 0) {
+        uint32_t base = offset & ~(FLASH_PAGE_SIZE - 1);
+        uint32_t start = offset - base;
+        size_t n = FLASH_PAGE_SIZE - start;
+        if (n > len) {
+            n = len;
         }
-        flash_range_program(SAVE_SECTOR_OFFSET + data_page * FLASH_PAGE_SIZE,
-                            (uint8_t *)&old_data, FLASH_PAGE_SIZE);
+        memset(page, 0xff, sizeof(page));
+        memcpy(page + start, src, n);
+
+        TRACE_BEGIN(TRACE_FLASH_PROGRAM, base / FLASH_PAGE_SIZE);
+        uint32_t ints = save_and_disable_interrupts();
+        flash_range_program(base, page, FLASH_PAGE_SIZE);
         restore_interrupts(ints);
-        mutex_exit(io_lock);
+        TRACE_END(TRACE_FLASH_PROGRAM, base / FLASH_PAGE_SIZE);
+
+        offset += n;
+        src += n;
+        len -= n;
+    }
+}
+
+/* offset and len in whole words */
+static bool flash_blank(uint32_t offset, uint32_t len)
+{
+    const uint32_t *p = (const uint32_t *)flash_ptr(offset);
+    for (int i = 0; i < len / 4; i++) {
+        if (p[i] != 0xffffffff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool sector_blank(int sector)
+{
+    return flash_blank(sector_offset(sector), FLASH_SECTOR_SIZE);
+}
+
+static void append_record(uint16_t offset, uint16_t len, bool last)
+{
+    record_hdr_t rec = { last ? RECORD_KIND : RECORD_MORE, offset, len, 0 };
+    rec.crc = record_crc(&rec, new_data.data + offset);
+
+    uint32_t addr = sector_offset(journal.sector) + journal.pos;
+    flash_write(addr, &rec, sizeof(rec));
+    flash_write(addr + sizeof(rec), new_data.data + offset, len);
+    journal.pos += RECORD_ALIGN(sizeof(rec) + len);
+    journal.records++;
+}
+
+/* Snapshot goes in first, the header last, a sector only counts when both
+   made it. The current sector is never erased. */
+static void rollover()
+{
+    int next = (journal.sector + 1) % SAVE_SECTORS;
+    if (!journal.spare_erased) {
+        flash_erase(next);
+    }
+
+    journal.sector = next;
+    journal.seq++;
+    journal.pos = sizeof(sector_hdr_t);
+    journal.torn = false;
+    journal.spare_erased = false;
+    journal.records = 0;
+    append_record(0, data_size, true);
+
+    sector_hdr_t hdr = { my_magic, JOURNAL_TAG, journal.seq, journal.erases,
+                         data_size, 0 };
+    hdr.crc = crc16(0xffff, &hdr, offsetof(sector_hdr_t, crc));
+    flash_write(sector_offset(next), &hdr, sizeof(hdr));
+}
+
+/* deltas of changed module regions, trimmed to the changed bytes */
+static size_t collect_deltas(uint16_t deltas[][2])
+{
+    size_t num = 0;
+    for (int i = 0; i < module_num; i++) {
+        const uint8_t *a = old_data.data + modules[i].offset;
+        const uint8_t *b = new_data.data + modules[i].offset;
+        int first = -1;
+        int last = -1;
+        for (int j = 0; j < modules[i].size; j++) {
+            if (a[j] != b[j]) {
+                if (first < 0) {
+                    first = j;
+                }
+                last = j;
+            }
+        }
+        if (first >= 0) {
+            deltas[num][0] = modules[i].offset + first;
+            deltas[num][1] = last - first + 1;
+            num++;
+        }
+    }
+    return num;
+}
+
+static bool save_program()
+{
+    uint16_t deltas[ARRAY_SIZE(modules)][2];
+    size_t num = collect_deltas(deltas);
+
+    size_t need = 0;
+    for (int i = 0; i < num; i++) {
+        need += RECORD_ALIGN(sizeof(record_hdr_t) + deltas[i][1]);
+    }
+
+    if (!flash_begin()) {
+        return false;
+    }
+
+    if ((journal.sector < 0) || journal.torn ||
+        (journal.pos + need > FLASH_SECTOR_SIZE)) {
+        rollover();
     } else {
-        printf("Program Flash Failed.\n");
+        for (int i = 0; i < num; i++) {
+            append_record(deltas[i][0], deltas[i][1], i == num - 1);
+        }
+    }
+
+    flash_end();
+
+    old_data = new_data;
+    printf("\nProgram Flash %d:%lu %4lu, stall %lu us (max %lu us)\n",
+           journal.sector, journal.seq, journal.pos, stall.last, stall.max);
+    return true;
+}
+
+/* Erase the next sector ahead of time, so rollovers only program */
+static void save_compact()
+{
+    if ((journal.sector < 0) || journal.spare_erased ||
+        (journal.pos < FLASH_SECTOR_SIZE * 3 / 4)) {
+        return;
+    }
+
+    int next = (journal.sector + 1) % SAVE_SECTORS;
+    if (!sector_blank(next)) {
+        if (!flash_begin()) {
+            return;
+        }
+        flash_erase(next);
+        flash_end();
+        printf("\nErase Flash %d, stall %lu us (max %lu us)\n", next,
+               stall.last, stall.max);
     }
+    journal.spare_erased = true;
 }
 
 static void load_default()
 {
     printf("Load Default\n");
     new_data = default_data;
-    new_data.magic = my_magic;
 }
 
-static const page_t *get_page(int id)
+static bool load_legacy()
 {
-    int addr = XIP_BASE + SAVE_SECTOR_OFFSET;
-    return (page_t *)(addr + FLASH_PAGE_SIZE * id);
+    typedef struct __attribute ((packed)) {
+        uint32_t magic;
+        uint8_t data[FLASH_PAGE_SIZE - 4];
+    } page_t;
+
+    const page_t *pages = (const page_t *)flash_ptr(LEGACY_SECTOR_OFFSET);
+    int latest = -1;
+    for (int i = 0; i < FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE; i++) {
+        if (pages[i].magic != my_magic) {
+            break;
+        }
+        latest = i;
+    }
+
+    if (latest < 0) {
+        return false;
+    }
+
+    /* fields and regions added since then keep their defaults */
+    new_data = default_data;
+    size_t size = (module_num > 0) ? modules[0].size : 0;
+    if (size > LEGACY_DATA_SIZE) {
+        size = LEGACY_DATA_SIZE;
+    }
+    memcpy(new_data.data, pages[latest].data, size);
+    printf("Legacy Page Loaded %d\n", latest);
+    return true;
 }
 
-static void save_load()
+static bool sector_valid(int sector, sector_hdr_t *hdr)
 {
-    for (int i = 0; i < FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE; i++) {
-        if (get_page(i)->magic != my_magic) {
+    memcpy(hdr, flash_ptr(sector_offset(sector)), sizeof(*hdr));
+    return (hdr->magic == my_magic) && (hdr->tag == JOURNAL_TAG) &&
+           (hdr->size <= SAVE_DATA_SIZE) &&
+           (hdr->crc == crc16(0xffff, hdr, offsetof(sector_hdr_t, crc)));
+}
+
+/* Replays records until the erased tail, a broken one ends it early. The
+   records of a save only count once its last one is in. */
+static void replay(int sector)
+{
+    static image_t staged;
+    const uint8_t *base = flash_ptr(sector_offset(sector));
+    uint32_t pos = sizeof(sector_hdr_t);
+    uint32_t end = pos; // after the last complete save
+    journal.records = 0;
+    staged = new_data;
+
+    while (pos + sizeof(record_hdr_t) <= FLASH_SECTOR_SIZE) {
+        record_hdr_t rec;
+        memcpy(&rec, base + pos, sizeof(rec));
+        if ((rec.kind == RECORD_ERASED) &&
+            flash_blank(sector_offset(sector) + pos, FLASH_SECTOR_SIZE - pos)) {
             break;
         }
-        data_page = i;
+        const uint8_t *data = base + pos + sizeof(rec);
+        if (((rec.kind != RECORD_KIND) && (rec.kind != RECORD_MORE)) ||
+            (rec.offset + rec.len > SAVE_DATA_SIZE) ||
+            (pos + sizeof(rec) + rec.len > FLASH_SECTOR_SIZE) ||
+            (rec.crc != record_crc(&rec, data))) {
+            journal.torn = true;
+            break;
+        }
+        memcpy(staged.data + rec.offset, data, rec.len);
+        pos += RECORD_ALIGN(sizeof(rec) + rec.len);
+        journal.records++;
+        if (rec.kind == RECORD_KIND) {
+            new_data = staged;
+            end = pos;
+        }
+    }
+
+    /* half a save at the tail, the next one must not join it */
+    if (end != pos) {
+        journal.torn = true;
+    }
+    journal.pos = pos;
+}
+
+static void save_load()
+{
+    sector_hdr_t hdr;
+    for (int i = 0; i < SAVE_SECTORS; i++) {
+        if (sector_valid(i, &hdr) &&
+            ((journal.sector < 0) || (hdr.seq > journal.seq))) {
+            journal.sector = i;
+            journal.seq = hdr.seq;
+            journal.erases = hdr.erases;
+        }
     }
 
-    if (data_page < 0) {
-        load_default();
+    if (journal.sector < 0) {
+        if (!load_legacy()) {
+            load_default();
+        }
         save_request(false);
         return;
     }
 
-    old_data = *get_page(data_page);
-    new_data = old_data;
-    printf("Page Loaded %d %8lx\n", data_page, new_data.magic);
+    /* modules added since the snapshot keep their defaults */
+    new_data = default_data;
+    replay(journal.sector);
+    old_data = new_data;
+    printf("Journal Loaded %d:%lu, %lu records, %lu bytes, %lu erases%s\n",
+           journal.sector, journal.seq, journal.records, journal.pos,
+           journal.erases, journal.torn ? ", torn tail" : "");
 }
 
 static void save_loaded()
@@ -140,39 +504,183 @@ void save_init(uint32_t magic, mutex_t *locker)
     save_loaded();
 }
 
+static int save_waiting(uint64_t now)
+{
+    if (now - sched.first >= SAVE_MAX_DEFER_US) {
+        return SAVE_WAIT_NONE;
+    }
+    if (!sched.urgent) {
+        if (now - sched.last < SAVE_COALESCE_US) {
+            return SAVE_WAIT_COALESCE;
+        }
+        if ((sched.writes > 0) && (now - sched.last_write < SAVE_INTERVAL_US)) {
+            return SAVE_WAIT_INTERVAL;
+        }
+    }
+    if (now - sched.last_activity < SAVE_IDLE_US) {
+        return SAVE_WAIT_INPUT;
+    }
+    return SAVE_WAIT_NONE;
+}
+
 void save_loop()
 {
-    if (requesting_save && (time_us_64() - requesting_time > SAVE_TIMEOUT_US)) {
-        requesting_save = false;
-        /* only when data is actually changed */
-        if (memcmp(&old_data, &new_data, sizeof(old_data)) == 0) {
-            return;
+    uint64_t now = time_us_64();
+
+    if (!sched.pending) {
+        if (now - sched.last_activity >= SAVE_IDLE_US) {
+            save_compact();
         }
-        save_program();
+        return;
+    }
+
+    if (save_waiting(now) != SAVE_WAIT_NONE) {
+        return;
+    }
+
+    /* only when data is actually changed */
+    if ((journal.sector >= 0) && !journal.torn &&
+        (memcmp(&old_data, &new_data, sizeof(old_data)) == 0)) {
+        sched.pending = false;
+        return;
+    }
+
+    if (save_program()) {
+        sched.pending = false;
+        sched.writes++;
+        sched.last_write = now;
+    } else {
+        sched.last = now; // try again later
     }
 }
 
+void save_activity()
+{
+    sched.last_activity = time_us_64();
+}
+
 void *save_alloc(size_t size, void *def, void (*after_load)())
 {
+    size_t offset = module_num > 0 ?
+                    modules[module_num - 1].offset + modules[module_num - 1].size : 0;
+    if ((module_num >= ARRAY_SIZE(modules)) || (offset + size > SAVE_DATA_SIZE)) {
+        return NULL;
+    }
     modules[module_num].size = size;
-    size_t offset = module_num > 0 ? modules[module_num - 1].offset + size : 0;
     modules[module_num].offset = offset;
     modules[module_num].after_load = after_load;
     module_num++;
+    data_size = offset + size;
     memcpy(default_data.data + offset, def, size); // backup the default
     return new_data.data + offset;
 }
 
+size_t save_export(uint8_t *buf, size_t size)
+{
+    size_t total = sizeof(snapshot_hdr_t) + data_size + 2;
+    if (size < total) {
+        return 0;
+    }
+
+    snapshot_hdr_t hdr = { my_magic, SNAPSHOT_VERSION, data_size, module_num, 0 };
+    for (int i = 0; i < module_num; i++) {
+        hdr.module_size[i] = modules[i].size;
+    }
+    memcpy(buf, &hdr, sizeof(hdr));
+    memcpy(buf + sizeof(hdr), new_data.data, data_size);
+
+    uint16_t crc = crc16(0xffff, buf, total - 2);
+    buf[total - 2] = crc & 0xff;
+    buf[total - 1] = crc >> 8;
+    return total;
+}
+
+/* Regions from an older layout may be shorter, the rest keeps defaults.
+   Modules' after_load() checks run on the result, anything they have to
+   fix means a bad snapshot and the old config stays. */
+bool save_import(const uint8_t *buf, size_t len)
+{
+    static image_t backup;
+    static image_t staged;
+
+    snapshot_hdr_t hdr;
+    if (len < sizeof(hdr) + 2) {
+        return false;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if ((hdr.magic != my_magic) || (hdr.version != SNAPSHOT_VERSION) ||
+        (hdr.module_num > module_num) ||
+        (len != sizeof(hdr) + hdr.size + 2)) {
+        return false;
+    }
+
+    uint16_t crc = crc16(0xffff, buf, len - 2);
+    if ((buf[len - 2] != (crc & 0xff)) || (buf[len - 1] != (crc >> 8))) {
+        return false;
+    }
+
+    backup = new_data;
+    new_data = default_data;
+
+    const uint8_t *src = buf + sizeof(hdr);
+    size_t remain = hdr.size;
+    for (int i = 0; i < hdr.module_num; i++) {
+        size_t size = hdr.module_size[i];
+        if ((size > modules[i].size) || (size > remain)) {
+            new_data = backup;
+            return false;
+        }
+        memcpy(new_data.data + modules[i].offset, src, size);
+        src += size;
+        remain -= size;
+    }
+
+    /* the checks ask for a save when they fix something, drop that too */
+    bool pending = sched.pending;
+    uint64_t last = sched.last;
+
+    staged = new_data;
+    save_loaded();
+    if (memcmp(&staged, &new_data, sizeof(staged)) != 0) {
+        new_data = backup;
+        save_loaded();
+        sched.pending = pending;
+        sched.last = last;
+        return false;
+    }
+
+    save_request(true);
+    return true;
+}
+
+/* Changes coalesce into one write, which always happens in save_loop() */
 void save_request(bool immediately)
 {
-    if (!requesting_save) {
+    uint64_t now = time_us_64();
+    if (!sched.pending) {
         printf("Save requested.\n");
-        requesting_save = true;
-        new_data.magic = my_magic;
-        requesting_time = time_us_64();
+        sched.pending = true;
+        sched.urgent = false;
+        sched.first = now;
     }
+    sched.last = now;
     if (immediately) {
-        requesting_time = 0;
-        save_loop();
+        sched.urgent = true;
     }
 }
+
+const save_stats_t *save_stats()
+{
+    uint64_t now = time_us_64();
+    stats.pending = sched.pending;
+    stats.waiting = sched.pending ? save_waiting(now) : SAVE_WAIT_NONE;
+    stats.pending_ms = sched.pending ? (now - sched.first) / 1000 : 0;
+    stats.writes = sched.writes;
+    stats.erases = journal.erases;
+    stats.sector = journal.sector;
+    stats.seq = journal.seq;
+    stats.used = journal.pos;
+    stats.stall_last = stall.last;
+    stats.stall_max = stall.max;
+    return &stats;
+}
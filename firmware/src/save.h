@@ -22,6 +22,39 @@ void save_init(uint32_t magic, mutex_t *lock);
 void save_loop();
 
 void *save_alloc(size_t size, void *def, void (*after_load)());
+
+/* immediately: skip coalescing and the write interval, still waits for
+   idle input and goes through save_loop() */
 void save_request(bool immediately);
 
+/* Versioned snapshot of all regions with a CRC, returns its length, or
+   0 if buf is too small. Import checks it and saves it if all is fine. */
+size_t save_export(uint8_t *buf, size_t size);
+bool save_import(const uint8_t *buf, size_t len);
+
+/* input activity holds pending saves back */
+void save_activity();
+
+enum {
+    SAVE_WAIT_NONE = 0,
+    SAVE_WAIT_COALESCE,
+    SAVE_WAIT_INTERVAL,
+    SAVE_WAIT_INPUT,
+};
+
+typedef struct {
+    bool pending;
+    int waiting; // SAVE_WAIT_*
+    uint32_t pending_ms;
+    uint32_t writes; // since boot
+    uint32_t erases; // lifetime, kept in flash
+    int sector;
+    uint32_t seq;
+    uint32_t used; // bytes of the current sector
+    uint32_t stall_last; // us
+    uint32_t stall_max;
+} save_stats_t;
+
+const save_stats_t *save_stats();
+
 #endif
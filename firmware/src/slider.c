@@ -0,0 +1,480 @@
+/*
+ * Chu Arcade Slider Port Bridge
+ * WHowe <github.com/whowechina>
+ *
+ * Bridges the slider UART to CDC 1. Both directions are DMA driven, UART RX
+ * lands in a ring buffer and is flushed to USB on frame boundaries, when a
+ * full packet is pending, or after the line goes idle.
+ *
+ * Frames are decoded on the way through. Touch reports give a local touch
+ * state, and when the host goes quiet, the slider LEDs follow the touch
+ * state directly instead of waiting for the host round trip.
+ *
+ * Host frames are reassembled before they go out. LED frames are the bulk of
+ * the line time, so they wait behind other host frames and a newer one
+ * replaces a pending one.
+ */
+
+#include "slider.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bsp/board.h"
+#include "hardware/gpio.h"
+#include "hardware/uart.h"
+#include "hardware/dma.h"
+
+#include "tusb.h"
+
+#include "board_defs.h"
+#include "config.h"
+#include "slider_proto.h"
+#include "trace.h"
+
+#define SLIDER_CDC 1
+#define SLIDER_DEFAULT_BAUD 115200
+#define USB_PACKET_SIZE 64
+#define MIN_IDLE_FLUSH_US 50
+#define HOST_IDLE_US 1000000
+#define TOUCH_THRESHOLD 20
+
+#define RX_RING_BITS 10 // ~90ms at 115200, rides out a sector erase
+#define RX_RING_SIZE (1 << RX_RING_BITS)
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+#define RX_DMA_COUNT 0xffffffff
+
+static uint8_t rx_ring[RX_RING_SIZE] __attribute__((aligned(RX_RING_SIZE)));
+static uint8_t tx_buf[256]; // being sent by tx dma
+
+static struct {
+    uint8_t buf[256];
+    int len;
+} urgent; // non-LED host frames and stray bytes
+
+static struct {
+    uint8_t buf[256];
+    int len;
+    bool ready;
+} led; // latest host LED frame
+
+static struct {
+    uint8_t buf[256];
+    int len;
+} frame; // host frame being reassembled
+
+static uint32_t idle_flush_us;
+
+static int rx_dma;
+static int tx_dma;
+
+static uint32_t rx_base; // ring index when rx dma was armed
+static uint32_t rx_tail; // bytes consumed since rx dma was armed
+
+static struct {
+    uint32_t bytes;
+    uint64_t since;
+    uint64_t last_rx;
+} pending;
+
+static slider_stats_t stats;
+
+static slider_decoder_t rx_dec;
+static slider_decoder_t tx_dec;
+
+static volatile uint32_t touch;
+static uint64_t touch_time;
+static uint64_t host_time;
+static uint64_t scan_on_time;
+static uint32_t local_led_touch;
+static bool local_led_valid;
+
+static struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint64_t time;
+} rate_mark;
+
+static void rx_dma_arm()
+{
+    uint32_t write_addr = (uint32_t)rx_ring;
+    if (dma_channel_is_busy(rx_dma)) {
+        write_addr = dma_hw->ch[rx_dma].write_addr;
+        dma_channel_abort(rx_dma); // unread bytes wait in UART FIFO
+    }
+
+    rx_base = (write_addr - (uint32_t)rx_ring) & RX_RING_MASK;
+    rx_tail = 0;
+
+    dma_channel_config c = dma_channel_get_default_config(rx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, RX_RING_BITS);
+    channel_config_set_dreq(&c, uart_get_dreq(SLIDER_UART, false));
+    dma_channel_configure(rx_dma, &c, rx_ring + rx_base,
+                          &uart_get_hw(SLIDER_UART)->dr, RX_DMA_COUNT, true);
+}
+
+static void tx_dma_init()
+{
+    dma_channel_config c = dma_channel_get_default_config(tx_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, uart_get_dreq(SLIDER_UART, true));
+    dma_channel_configure(tx_dma, &c, &uart_get_hw(SLIDER_UART)->dr,
+                          tx_buf, 0, false);
+}
+
+void slider_set_baud(uint32_t baud)
+{
+    stats.baud = uart_set_baudrate(SLIDER_UART, baud);
+    /* flush after about 2.5 bytes of idle line time */
+    idle_flush_us = 25000000 / stats.baud;
+    if (idle_flush_us < MIN_IDLE_FLUSH_US) {
+        idle_flush_us = MIN_IDLE_FLUSH_US;
+    }
+}
+
+bool slider_set_flow(bool on)
+{
+#if defined(SLIDER_CTS) && defined(SLIDER_RTS)
+    uart_set_hw_flow(SLIDER_UART, on, on);
+    return true;
+#else
+    return !on;
+#endif
+}
+
+void slider_config_changed()
+{
+    uint32_t baud = chu_cfg->slider.baud;
+    if (baud == 0) {
+        /* back to following the host, which may not send line coding again */
+        cdc_line_coding_t coding;
+        tud_cdc_n_get_line_coding(SLIDER_CDC, &coding);
+        baud = (coding.bit_rate >= 9600) ? coding.bit_rate : SLIDER_DEFAULT_BAUD;
+    }
+    slider_set_baud(baud);
+    slider_set_flow(chu_cfg->slider.flow);
+}
+
+void slider_init()
+{
+    gpio_set_function(SLIDER_TX, GPIO_FUNC_UART);
+    gpio_set_function(SLIDER_RX, GPIO_FUNC_UART);
+    gpio_pull_up(SLIDER_TX);
+    gpio_pull_up(SLIDER_RX);
+#if defined(SLIDER_CTS) && defined(SLIDER_RTS)
+    gpio_set_function(SLIDER_CTS, GPIO_FUNC_UART);
+    gpio_set_function(SLIDER_RTS, GPIO_FUNC_UART);
+#endif
+    uart_init(SLIDER_UART, SLIDER_DEFAULT_BAUD);
+    slider_set_baud(SLIDER_DEFAULT_BAUD);
+    slider_config_changed();
+
+    rx_dma = dma_claim_unused_channel(true);
+    tx_dma = dma_claim_unused_channel(true);
+    rx_dma_arm();
+    tx_dma_init();
+
+    slider_decoder_reset(&rx_dec);
+    slider_decoder_reset(&tx_dec);
+}
+
+static inline uint32_t rx_head()
+{
+    return RX_DMA_COUNT - dma_hw->ch[rx_dma].transfer_count;
+}
+
+static void rx_frame(uint64_t now)
+{
+    if ((rx_dec.cmd != SLIDER_CMD_REPORT) || (rx_dec.len != SLIDER_KEY_NUM)) {
+        return;
+    }
+
+    touch = slider_touch_bitmap(rx_dec.data, TOUCH_THRESHOLD);
+    touch_time = now;
+    TRACE_INSTANT(TRACE_SLIDER_FRAME, 0);
+}
+
+static void flush_usb(uint64_t now)
+{
+    tud_cdc_n_write_flush(SLIDER_CDC);
+    stats.flushes++;
+
+    uint32_t latency = now - pending.since;
+    stats.latency_sum += latency;
+    if (latency > stats.latency_max) {
+        stats.latency_max = latency;
+    }
+    pending.bytes = 0;
+}
+
+static void rx_to_usb(uint64_t now)
+{
+    uint32_t avail = rx_head() - rx_tail;
+    if (avail > RX_RING_SIZE) {
+        stats.overruns++;
+        rx_tail += avail - RX_RING_SIZE;
+        avail = RX_RING_SIZE;
+    }
+
+    if (avail > 0) {
+        if (pending.bytes == 0) {
+            pending.since = now;
+        }
+        pending.last_rx = now;
+    }
+
+    while (avail > 0) {
+        uint32_t space = tud_cdc_n_write_available(SLIDER_CDC);
+        if (space == 0) {
+            break;
+        }
+
+        uint32_t index = (rx_base + rx_tail) & RX_RING_MASK;
+        uint32_t chunk = RX_RING_SIZE - index;
+        chunk = chunk < avail ? chunk : avail;
+        chunk = chunk < space ? chunk : space;
+
+        bool boundary = false;
+        for (int i = 0; i < chunk; i++) {
+            int result = slider_decode(&rx_dec, rx_ring[index + i]);
+            if (result == SLIDER_DECODE_FRAME) {
+                rx_frame(now);
+            }
+            if (result != SLIDER_DECODE_BUSY) {
+                chunk = i + 1;
+                boundary = true;
+                break;
+            }
+        }
+
+        tud_cdc_n_write(SLIDER_CDC, rx_ring + index, chunk);
+        rx_tail += chunk;
+        avail -= chunk;
+        stats.rx_bytes += chunk;
+        pending.bytes += chunk;
+
+        if (boundary || (pending.bytes >= USB_PACKET_SIZE)) {
+            flush_usb(now);
+            if (avail > 0) {
+                pending.since = now;
+            }
+        }
+    }
+
+    if ((pending.bytes > 0) && (now - pending.last_rx >= idle_flush_us)) {
+        flush_usb(now);
+    }
+
+    /* re-arm long before the counter runs out, only when fully drained */
+    if ((avail == 0) && (rx_tail > RX_DMA_COUNT / 2)) {
+        rx_dma_arm();
+    }
+}
+
+static void queue_urgent(const uint8_t *data, int len)
+{
+    memcpy(urgent.buf + urgent.len, data, len);
+    urgent.len += len;
+}
+
+static void host_frame_done(int result, uint64_t now)
+{
+    if (result == SLIDER_DECODE_FRAME) {
+        host_time = now;
+        if (tx_dec.cmd == SLIDER_CMD_LED) {
+            stats.host_leds++;
+            if (led.ready) {
+                stats.led_replaced++;
+            }
+            memcpy(led.buf, frame.buf, frame.len);
+            led.len = frame.len;
+            led.ready = true;
+            frame.len = 0;
+            return;
+        }
+    }
+    queue_urgent(frame.buf, frame.len);
+    frame.len = 0;
+}
+
+static void host_byte(uint8_t c, uint64_t now)
+{
+    if (c == SLIDER_SYNC && frame.len > 0) {
+        queue_urgent(frame.buf, frame.len); // broken frame, pass it on
+        frame.len = 0;
+    }
+
+    int result = slider_decode(&tx_dec, c);
+    if ((frame.len == 0) && (c != SLIDER_SYNC)) {
+        queue_urgent(&c, 1); // not in a frame
+        return;
+    }
+
+    frame.buf[frame.len++] = c;
+    if (result != SLIDER_DECODE_BUSY) {
+        host_frame_done(result, now);
+    } else if (frame.len == sizeof(frame.buf)) {
+        queue_urgent(frame.buf, frame.len); // too long to hold
+        frame.len = 0;
+    }
+}
+
+static void usb_to_queue(uint64_t now)
+{
+    /* a whole frame may move to urgent, keep room for it */
+    int room = sizeof(urgent.buf) - urgent.len - frame.len;
+    if ((room <= 0) || !tud_cdc_n_available(SLIDER_CDC)) {
+        return;
+    }
+
+    uint8_t buf[64];
+    int len = tud_cdc_n_read(SLIDER_CDC, buf, room < sizeof(buf) ? room : sizeof(buf));
+    for (int i = 0; i < len; i++) {
+        host_byte(buf[i], now);
+    }
+}
+
+static void queue_to_tx()
+{
+    if (dma_channel_is_busy(tx_dma)) {
+        return;
+    }
+
+    if (urgent.len > 0) {
+        memcpy(tx_buf, urgent.buf, urgent.len);
+        dma_channel_transfer_from_buffer_now(tx_dma, tx_buf, urgent.len);
+        stats.tx_bytes += urgent.len;
+        urgent.len = 0;
+    } else if (led.ready) {
+        memcpy(tx_buf, led.buf, led.len);
+        dma_channel_transfer_from_buffer_now(tx_dma, tx_buf, led.len);
+        stats.tx_bytes += led.len;
+        led.ready = false;
+    }
+}
+
+static void local_send(uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+    int size = slider_encode(tx_buf, sizeof(tx_buf), cmd, data, len);
+    if (size > 0) {
+        dma_channel_transfer_from_buffer_now(tx_dma, tx_buf, size);
+    }
+}
+
+static inline void put_brg(uint8_t *brg, uint32_t color)
+{
+    brg[0] = color & 0xff;
+    brg[1] = (color >> 16) & 0xff;
+    brg[2] = (color >> 8) & 0xff;
+}
+
+/* Host is quiet (e.g. NKRO mode), keep the slider scanning and lit locally */
+static void local_fast_path(uint64_t now)
+{
+    if (now - host_time < HOST_IDLE_US) {
+        local_led_valid = false;
+        return;
+    }
+
+    if (dma_channel_is_busy(tx_dma) || urgent.len || led.ready || frame.len) {
+        return;
+    }
+
+    if ((now - touch_time >= HOST_IDLE_US) &&
+        (now - scan_on_time >= HOST_IDLE_US)) {
+        scan_on_time = now;
+        local_send(SLIDER_CMD_SCAN_ON, NULL, 0);
+        return;
+    }
+
+    uint32_t bitmap = touch;
+    if (local_led_valid && (bitmap == local_led_touch)) {
+        return;
+    }
+
+    uint8_t frame[SLIDER_LED_LEN] = { chu_cfg->style.level };
+    for (int i = 0; i < SLIDER_LED_NUM; i++) {
+        uint32_t color = chu_cfg->colors.gap;
+        if (i % 2 == 0) {
+            bool upper = bitmap & (1ul << i);
+            bool lower = bitmap & (1ul << (i + 1));
+            color = upper && lower ? chu_cfg->colors.key_on_both :
+                    upper ? chu_cfg->colors.key_on_upper :
+                    lower ? chu_cfg->colors.key_on_lower :
+                    chu_cfg->colors.key_off;
+        }
+        put_brg(frame + 1 + i * 3, color);
+    }
+
+    local_send(SLIDER_CMD_LED, frame, sizeof(frame));
+    local_led_touch = bitmap;
+    local_led_valid = true;
+}
+
+static void update_rates(uint64_t now)
+{
+    if (now - rate_mark.time < 1000000) {
+        return;
+    }
+    stats.rx_rate = stats.rx_bytes - rate_mark.rx_bytes;
+    stats.tx_rate = stats.tx_bytes - rate_mark.tx_bytes;
+    rate_mark.rx_bytes = stats.rx_bytes;
+    rate_mark.tx_bytes = stats.tx_bytes;
+    rate_mark.time = now;
+}
+
+void slider_update()
+{
+    uint64_t now = time_us_64();
+    usb_to_queue(now);
+    queue_to_tx();
+    rx_to_usb(now);
+    local_fast_path(now);
+    update_rates(now);
+}
+
+const slider_stats_t *slider_stats()
+{
+    stats.rx_frames = rx_dec.frames;
+    stats.rx_errors = rx_dec.errors;
+    stats.tx_frames = tx_dec.frames;
+    stats.tx_errors = tx_dec.errors;
+    return &stats;
+}
+
+uint32_t slider_touch()
+{
+    return touch;
+}
+
+bool slider_host_active()
+{
+    return time_us_64() - host_time < HOST_IDLE_US;
+}
+
+void slider_clear_stats()
+{
+    uint32_t baud = stats.baud;
+    memset(&stats, 0, sizeof(stats));
+    stats.baud = baud;
+    rx_dec.frames = 0;
+    rx_dec.errors = 0;
+    tx_dec.frames = 0;
+    tx_dec.errors = 0;
+    memset(&rate_mark, 0, sizeof(rate_mark));
+}
+
+/* Host changes the slider CDC baud rate, follow it unless overridden */
+void tud_cdc_line_coding_cb(uint8_t itf, cdc_line_coding_t const *p_line_coding)
+{
+    if ((itf == SLIDER_CDC) && (chu_cfg->slider.baud == 0) &&
+        (p_line_coding->bit_rate >= 9600)) {
+        slider_set_baud(p_line_coding->bit_rate);
+    }
+}
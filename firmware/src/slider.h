@@ -0,0 +1,44 @@
+/*
+ * Chu Arcade Slider Port Bridge
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef SLIDER_H
+#define SLIDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t rx_rate; // bytes per second
+    uint32_t tx_rate;
+    uint32_t flushes;
+    uint32_t overruns;
+    uint32_t latency_max; // us, from a byte seen to it being flushed to USB
+    uint32_t latency_sum;
+    uint32_t rx_frames;
+    uint32_t rx_errors;
+    uint32_t tx_frames;
+    uint32_t tx_errors;
+    uint32_t host_leds; // LED frames from host
+    uint32_t led_replaced; // pending LED frames replaced by newer ones
+    uint32_t baud;
+} slider_stats_t;
+
+void slider_init();
+void slider_update();
+
+void slider_set_baud(uint32_t baud);
+bool slider_set_flow(bool on); // false if flow control pins are not there
+void slider_config_changed(); // apply chu_cfg->slider
+
+const slider_stats_t *slider_stats();
+void slider_clear_stats();
+
+/* bit n for touch key n, from the latest slider report */
+uint32_t slider_touch();
+bool slider_host_active();
+
+#endif
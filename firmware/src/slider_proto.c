@@ -0,0 +1,128 @@
+/*
+ * Chu Arcade Slider Protocol Frames
+ * WHowe <github.com/whowechina>
+ *
+ * Byte-wise decoder and encoder, no hardware dependency.
+ */
+
+#include "slider_proto.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+enum {
+    DEC_IDLE = 0,
+    DEC_CMD,
+    DEC_LEN,
+    DEC_DATA,
+    DEC_SUM,
+};
+
+void slider_decoder_reset(slider_decoder_t *dec)
+{
+    dec->state = DEC_IDLE;
+    dec->escaping = false;
+}
+
+int slider_decode(slider_decoder_t *dec, uint8_t c)
+{
+    if (c == SLIDER_SYNC) {
+        bool broken = (dec->state != DEC_IDLE);
+        dec->state = DEC_CMD;
+        dec->escaping = false;
+        dec->sum = SLIDER_SYNC;
+        if (broken) {
+            dec->errors++;
+        }
+        return SLIDER_DECODE_BUSY;
+    }
+
+    if (dec->state == DEC_IDLE) {
+        return SLIDER_DECODE_BUSY;
+    }
+
+    if (c == SLIDER_ESCAPE) {
+        dec->escaping = true;
+        return SLIDER_DECODE_BUSY;
+    }
+
+    if (dec->escaping) {
+        dec->escaping = false;
+        c++;
+    }
+
+    dec->sum += c;
+
+    switch (dec->state) {
+        case DEC_CMD:
+            dec->cmd = c;
+            dec->state = DEC_LEN;
+            break;
+        case DEC_LEN:
+            dec->len = c;
+            dec->pos = 0;
+            dec->state = (c > 0) ? DEC_DATA : DEC_SUM;
+            break;
+        case DEC_DATA:
+            dec->data[dec->pos++] = c;
+            if (dec->pos == dec->len) {
+                dec->state = DEC_SUM;
+            }
+            break;
+        case DEC_SUM:
+            dec->state = DEC_IDLE;
+            if (dec->sum != 0) {
+                dec->errors++;
+                return SLIDER_DECODE_ERROR;
+            }
+            dec->frames++;
+            return SLIDER_DECODE_FRAME;
+    }
+
+    return SLIDER_DECODE_BUSY;
+}
+
+uint32_t slider_touch_bitmap(const uint8_t *report, uint8_t threshold)
+{
+    uint32_t bitmap = 0;
+    for (int i = 0; i < SLIDER_KEY_NUM; i++) {
+        if (report[i] >= threshold) {
+            bitmap |= (1ul << i);
+        }
+    }
+    return bitmap;
+}
+
+static inline int put_escaped(uint8_t *buf, int pos, uint8_t c)
+{
+    if ((c == SLIDER_SYNC) || (c == SLIDER_ESCAPE)) {
+        buf[pos++] = SLIDER_ESCAPE;
+        c--;
+    }
+    buf[pos++] = c;
+    return pos;
+}
+
+int slider_encode(uint8_t *buf, int size, uint8_t cmd,
+                  const uint8_t *data, uint8_t len)
+{
+    /* worst case every byte after the sync is escaped */
+    if (size < 1 + (len + 3) * 2) {
+        return 0;
+    }
+
+    int pos = 0;
+    buf[pos++] = SLIDER_SYNC;
+    uint8_t sum = SLIDER_SYNC + cmd + len;
+
+    pos = put_escaped(buf, pos, cmd);
+    pos = put_escaped(buf, pos, len);
+    for (int i = 0; i < len; i++) {
+        pos = put_escaped(buf, pos, data[i]);
+        sum += data[i];
+    }
+    pos = put_escaped(buf, pos, -sum);
+
+    return pos;
+}
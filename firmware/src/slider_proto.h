@@ -0,0 +1,61 @@
+/*
+ * Chu Arcade Slider Protocol Frames
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef SLIDER_PROTO_H
+#define SLIDER_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Frame: 0xff, cmd, len, data[len], checksum (all bytes sum to 0)
+ * 0xff and 0xfd after the sync are sent as 0xfd, value - 1
+ */
+#define SLIDER_SYNC 0xff
+#define SLIDER_ESCAPE 0xfd
+
+enum {
+    SLIDER_CMD_REPORT = 0x01,
+    SLIDER_CMD_LED = 0x02,
+    SLIDER_CMD_SCAN_ON = 0x03,
+    SLIDER_CMD_SCAN_OFF = 0x04,
+    SLIDER_CMD_RESET = 0x10,
+    SLIDER_CMD_INFO = 0xf0,
+};
+
+#define SLIDER_KEY_NUM 32
+#define SLIDER_LED_NUM 31
+#define SLIDER_LED_LEN 97 // brightness and 32 BRG triples
+
+enum {
+    SLIDER_DECODE_BUSY = 0,
+    SLIDER_DECODE_FRAME,
+    SLIDER_DECODE_ERROR,
+};
+
+typedef struct {
+    uint8_t state;
+    bool escaping;
+    uint8_t cmd;
+    uint8_t len;
+    uint8_t pos;
+    uint8_t sum;
+    uint8_t data[256];
+    uint32_t frames;
+    uint32_t errors;
+} slider_decoder_t;
+
+void slider_decoder_reset(slider_decoder_t *dec);
+
+/* Feed one byte, frame is in dec->cmd, dec->len, dec->data on FRAME */
+int slider_decode(slider_decoder_t *dec, uint8_t c);
+
+/* bit n for key n of a report frame at or above threshold */
+uint32_t slider_touch_bitmap(const uint8_t *report, uint8_t threshold);
+
+/* Returns encoded length, 0 if buf is too small */
+int slider_encode(uint8_t *buf, int size, uint8_t cmd,
+                  const uint8_t *data, uint8_t len);
+
+#endif
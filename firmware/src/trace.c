@@ -0,0 +1,67 @@
+/*
+ * Event Tracing
+ * WHowe <github.com/whowechina>
+ *
+ * Per core rings of timestamped begin/end/instant events, read out over
+ * the vendor port and turned into a Chrome/Perfetto trace on the host.
+ */
+
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if TRACE_ENABLED
+
+trace_ring_t trace_rings[2];
+volatile bool trace_paused;
+
+void trace_pause(bool pause)
+{
+    trace_paused = pause;
+}
+
+void trace_clear()
+{
+    memset(trace_rings, 0, sizeof(trace_rings));
+}
+
+int trace_read(int core, int index, trace_event_t *out, int num, int *total)
+{
+    if ((core < 0) || (core > 1)) {
+        *total = 0;
+        return 0;
+    }
+
+    const trace_ring_t *ring = &trace_rings[core];
+    uint32_t head = ring->head;
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    uint32_t first = head - count;
+
+    *total = count;
+    int n = 0;
+    for (; (n < num) && (index + n < count); n++) {
+        uint32_t i = (first + index + n) & (TRACE_RING_SIZE - 1);
+        out[n] = ring->events[i];
+    }
+    return n;
+}
+
+#else
+
+void trace_pause(bool pause)
+{
+}
+
+void trace_clear()
+{
+}
+
+int trace_read(int core, int index, trace_event_t *out, int num, int *total)
+{
+    *total = 0;
+    return 0;
+}
+
+#endif
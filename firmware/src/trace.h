@@ -0,0 +1,90 @@
+/*
+ * Event Tracing
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Build with -DCHU_TRACE=ON to get it, otherwise events cost nothing */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 0
+#endif
+
+/* Keep in sync with tools/chu_trace.py */
+enum {
+    TRACE_AIR = 0, // ToF sensor reads
+    TRACE_HID, // report submitted, arg: 0 joystick, 1 nkro
+    TRACE_FLASH_ERASE,
+    TRACE_FLASH_PROGRAM,
+    TRACE_PN532, // command in flight, arg: command code
+    TRACE_LED_FRAME, // DMA started, arg: chain length
+    TRACE_SLIDER_FRAME, // slider report decoded
+    TRACE_PROFILE, // profile switched, arg: profile id
+};
+
+enum {
+    TRACE_TYPE_BEGIN = 0,
+    TRACE_TYPE_END,
+    TRACE_TYPE_INSTANT,
+};
+
+#define TRACE_RING_SIZE 512 // events per core, power of 2
+
+typedef struct {
+    uint32_t time; // us
+    uint8_t id;
+    uint8_t type;
+    uint16_t arg;
+} trace_event_t;
+
+#if TRACE_ENABLED
+
+#include "hardware/structs/sio.h"
+#include "hardware/structs/timer.h"
+
+typedef struct {
+    uint32_t head;
+    trace_event_t events[TRACE_RING_SIZE];
+} trace_ring_t;
+
+extern trace_ring_t trace_rings[2];
+extern volatile bool trace_paused;
+
+/* A few loads and stores, no locking, each core has its own ring */
+static inline void trace_put(uint8_t id, uint8_t type, uint16_t arg)
+{
+    if (trace_paused) {
+        return;
+    }
+    trace_ring_t *ring = &trace_rings[sio_hw->cpuid];
+    trace_event_t *ev = &ring->events[ring->head++ & (TRACE_RING_SIZE - 1)];
+    ev->time = timer_hw->timerawl;
+    ev->id = id;
+    ev->type = type;
+    ev->arg = arg;
+}
+
+#define TRACE_BEGIN(id, arg) trace_put(id, TRACE_TYPE_BEGIN, arg)
+#define TRACE_END(id, arg) trace_put(id, TRACE_TYPE_END, arg)
+#define TRACE_INSTANT(id, arg) trace_put(id, TRACE_TYPE_INSTANT, arg)
+
+#else
+
+#define TRACE_BEGIN(id, arg) ((void)0)
+#define TRACE_END(id, arg) ((void)0)
+#define TRACE_INSTANT(id, arg) ((void)0)
+
+#endif
+
+/* Pausing freezes both rings for a consistent dump */
+void trace_pause(bool pause);
+void trace_clear();
+
+/* Oldest first, returns how many were copied, total gets the ring's count */
+int trace_read(int core, int index, trace_event_t *out, int num, int *total);
+
+#endif
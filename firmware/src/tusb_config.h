@@ -100,15 +100,21 @@ extern "C" {
 #define CFG_TUD_CDC 3
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
-#define CFG_TUD_VENDOR 0
+
+// Vendor bulk interface for binary config/telemetry, set to 0 to remove it
+#ifndef CFG_TUD_VENDOR
+#define CFG_TUD_VENDOR 1
+#endif
 
 // HID buffer size Should be sufficient to hold ID (if any) + Data
 #define CFG_TUD_HID_EP_BUFSIZE 64
 
-#define CFG_TUD_VENDOR            0
+// Vendor FIFO size of TX and RX
+#define CFG_TUD_VENDOR_RX_BUFSIZE 512
+#define CFG_TUD_VENDOR_TX_BUFSIZE 512
 
-// HID buffer size Should be sufficient to hold ID (if any) + Data
-#define CFG_TUD_HID_EP_BUFSIZE    64
+// Vendor Endpoint transfer buffer size, full speed bulk max
+#define CFG_TUD_VENDOR_EPSIZE     64
 
 // CDC FIFO size of TX and RX
 #define CFG_TUD_CDC_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 128)
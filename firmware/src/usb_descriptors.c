@@ -102,12 +102,16 @@ enum { ITF_NUM_JOY, ITF_NUM_NKRO,
        ITF_NUM_CLI, ITF_NUM_CLI_DATA,
        ITF_NUM_SLIDER, ITF_NUM_SLIDER_DATA,
        ITF_NUM_AIME, ITF_NUM_AIME_DATA,
+#if CFG_TUD_VENDOR
+       ITF_NUM_VENDOR,
+#endif
        ITF_NUM_TOTAL };
 
 #define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + \
                           TUD_HID_INOUT_DESC_LEN * 1 + \
                           TUD_HID_DESC_LEN * 1 + \
-                          TUD_CDC_DESC_LEN * 3)
+                          TUD_CDC_DESC_LEN * 3 + \
+                          TUD_VENDOR_DESC_LEN * CFG_TUD_VENDOR)
 
 #define EPNUM_JOY 0x81
 #define EPNUM_OUTPUT 0x01
@@ -126,6 +130,9 @@ enum { ITF_NUM_JOY, ITF_NUM_NKRO,
 #define EPNUM_AIME_OUT   0x0a
 #define EPNUM_AIME_IN    0x8a
 
+#define EPNUM_VENDOR_OUT 0x0c
+#define EPNUM_VENDOR_IN  0x8c
+
 uint8_t const desc_configuration_joy[] = {
     // Config number, interface count, string index, total length, attribute,
     // power in mA
@@ -151,6 +158,11 @@ uint8_t const desc_configuration_joy[] = {
 
     TUD_CDC_DESCRIPTOR(ITF_NUM_AIME, 8, EPNUM_AIME_NOTIF,
                        8, EPNUM_AIME_OUT, EPNUM_AIME_IN, 64),
+
+#if CFG_TUD_VENDOR
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 9, EPNUM_VENDOR_OUT,
+                          EPNUM_VENDOR_IN, CFG_TUD_VENDOR_EPSIZE),
+#endif
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -176,6 +188,7 @@ const char *string_desc_arr[] = {
     "Chu Arcade CLI Port",
     "Chu Arcade SLIDER Port",
     "Chu Arcade AIME Port",
+    "Chu Arcade Vendor Port",
 };
 
 // Invoked when received GET STRING DESCRIPTOR request
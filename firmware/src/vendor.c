@@ -0,0 +1,390 @@
+/*
+ * Chu Controller Vendor Bulk Interface
+ * WHowe <github.com/whowechina>
+ *
+ * A framed binary protocol on a vendor class bulk interface, so config
+ * transfer, sensor streaming and LED frames don't mess with the CLI port.
+ */
+
+#include "vendor.h"
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tusb.h"
+
+#include "config.h"
+#include "save.h"
+#include "air.h"
+#include "button.h"
+#include "rgb.h"
+#include "lights.h"
+#include "slider.h"
+#include "trace.h"
+
+#if CFG_TUD_VENDOR
+
+#define VENDOR_ITF 0
+#define FRAME_OVERHEAD 5 // sync, cmd, len, checksum
+
+static struct {
+    uint8_t buf[VENDOR_MAX_PAYLOAD + FRAME_OVERHEAD];
+    int len;
+} rx;
+
+static uint8_t tx_buf[VENDOR_MAX_PAYLOAD + FRAME_OVERHEAD];
+
+static struct {
+    uint32_t interval_us;
+    uint64_t last;
+} stream;
+
+static bool send_frame(uint8_t cmd, const void *payload, uint16_t len)
+{
+    if (len > VENDOR_MAX_PAYLOAD) {
+        return false;
+    }
+    /* never block the input loop, the frame is dropped if it can't fit */
+    if (tud_vendor_n_write_available(VENDOR_ITF) < len + FRAME_OVERHEAD) {
+        return false;
+    }
+
+    tx_buf[0] = VENDOR_SYNC;
+    tx_buf[1] = cmd;
+    tx_buf[2] = len & 0xff;
+    tx_buf[3] = len >> 8;
+    memcpy(tx_buf + 4, payload, len);
+
+    uint8_t sum = 0;
+    for (int i = 1; i < len + 4; i++) {
+        sum += tx_buf[i];
+    }
+    tx_buf[len + 4] = sum;
+
+    tud_vendor_n_write(VENDOR_ITF, tx_buf, len + FRAME_OVERHEAD);
+    tud_vendor_n_write_flush(VENDOR_ITF);
+    return true;
+}
+
+static void reply(uint8_t cmd, uint8_t status, const void *data, uint16_t len)
+{
+    uint8_t payload[VENDOR_MAX_PAYLOAD];
+    if (len > sizeof(payload) - 1) {
+        len = sizeof(payload) - 1;
+    }
+    payload[0] = status;
+    if (len > 0) {
+        memcpy(payload + 1, data, len);
+    }
+    send_frame(cmd | VENDOR_REPLY, payload, len + 1);
+}
+
+static void cmd_ping(uint8_t cmd)
+{
+    uint64_t id = board_id_64();
+    reply(cmd, VENDOR_OK, &id, sizeof(id));
+}
+
+static void cmd_cfg_read(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (len != 4) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    uint16_t offset = param[0] | (param[1] << 8);
+    uint16_t size = param[2] | (param[3] << 8);
+    if ((offset + size > sizeof(*chu_cfg)) || (size > VENDOR_MAX_PAYLOAD - 1)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    reply(cmd, VENDOR_OK, (uint8_t *)chu_cfg + offset, size);
+}
+
+static void cmd_cfg_write(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (len < 2) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    uint16_t offset = param[0] | (param[1] << 8);
+    uint16_t size = len - 2;
+    if (offset + size > sizeof(*chu_cfg)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    chu_cfg_t cfg = *chu_cfg;
+    memcpy((uint8_t *)&cfg + offset, param + 2, size);
+    if (!config_check(&cfg)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    *chu_cfg = cfg;
+    slider_config_changed();
+    config_changed();
+    reply(cmd, VENDOR_OK, NULL, 0);
+}
+
+static void cmd_cfg_export(uint8_t cmd)
+{
+    uint8_t snapshot[VENDOR_MAX_PAYLOAD - 1];
+    size_t len = save_export(snapshot, sizeof(snapshot));
+    if (len == 0) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+    reply(cmd, VENDOR_OK, snapshot, len);
+}
+
+static void cmd_cfg_import(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (!save_import(param, len)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+    slider_config_changed();
+    reply(cmd, VENDOR_OK, NULL, 0);
+}
+
+static void cmd_sensor_stream(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (len != 1) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+    stream.interval_us = param[0] * 1000;
+    reply(cmd, VENDOR_OK, NULL, 0);
+}
+
+static void cmd_led_frame(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if ((len < 1) || ((len - 1) % 3 != 0)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    rgb_host_write(param[0], param + 1, (len - 1) / 3);
+    rgb_host_commit();
+    lights_host_frame();
+    reply(cmd, VENDOR_OK, NULL, 0);
+}
+
+static void cmd_led_stream(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if ((len < 2) || ((len - 2) % 3 != 0)) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    uint8_t flags = param[0];
+    rgb_host_write(param[1], param + 2, (len - 2) / 3);
+    if (flags & VENDOR_LED_COMMIT) {
+        rgb_host_commit();
+    }
+    lights_host_frame();
+
+    if (!(flags & VENDOR_LED_QUIET)) {
+        reply(cmd, VENDOR_OK, NULL, 0);
+    }
+}
+
+#if TRACE_ENABLED
+static void cmd_trace_ctrl(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (len != 1) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    switch (param[0]) {
+        case VENDOR_TRACE_RESUME:
+            trace_pause(false);
+            break;
+        case VENDOR_TRACE_PAUSE:
+            trace_pause(true);
+            break;
+        case VENDOR_TRACE_CLEAR:
+            trace_clear();
+            break;
+        default:
+            reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+            return;
+    }
+    reply(cmd, VENDOR_OK, NULL, 0);
+}
+
+static void cmd_trace_read(uint8_t cmd, const uint8_t *param, uint16_t len)
+{
+    if (len != 3) {
+        reply(cmd, VENDOR_ERR_PARAM, NULL, 0);
+        return;
+    }
+
+    trace_event_t events[(VENDOR_MAX_PAYLOAD - 3) / sizeof(trace_event_t)];
+    int total;
+    int num = trace_read(param[0], param[1] | (param[2] << 8), events,
+                         count_of(events), &total);
+
+    uint8_t data[2 + sizeof(events)];
+    data[0] = total & 0xff;
+    data[1] = total >> 8;
+    memcpy(data + 2, events, num * sizeof(trace_event_t));
+    reply(cmd, VENDOR_OK, data, 2 + num * sizeof(trace_event_t));
+}
+#endif
+
+static void handle_frame(uint8_t cmd, const uint8_t *payload, uint16_t len)
+{
+    switch (cmd) {
+        case VENDOR_CMD_PING:
+            cmd_ping(cmd);
+            break;
+        case VENDOR_CMD_CFG_READ:
+            cmd_cfg_read(cmd, payload, len);
+            break;
+        case VENDOR_CMD_CFG_WRITE:
+            cmd_cfg_write(cmd, payload, len);
+            break;
+        case VENDOR_CMD_CFG_EXPORT:
+            cmd_cfg_export(cmd);
+            break;
+        case VENDOR_CMD_CFG_IMPORT:
+            cmd_cfg_import(cmd, payload, len);
+            break;
+        case VENDOR_CMD_SENSOR_STREAM:
+            cmd_sensor_stream(cmd, payload, len);
+            break;
+        case VENDOR_CMD_LED_FRAME:
+            cmd_led_frame(cmd, payload, len);
+            break;
+        case VENDOR_CMD_LED_STREAM:
+            cmd_led_stream(cmd, payload, len);
+            break;
+#if TRACE_ENABLED
+        case VENDOR_CMD_TRACE_CTRL:
+            cmd_trace_ctrl(cmd, payload, len);
+            break;
+        case VENDOR_CMD_TRACE_READ:
+            cmd_trace_read(cmd, payload, len);
+            break;
+#endif
+        default:
+            reply(cmd, VENDOR_ERR_UNKNOWN_CMD, NULL, 0);
+            break;
+    }
+}
+
+static void rx_consume(int n)
+{
+    rx.len -= n;
+    memmove(rx.buf, rx.buf + n, rx.len);
+}
+
+static void parse_frames()
+{
+    while (rx.len > 0) {
+        if (rx.buf[0] != VENDOR_SYNC) {
+            uint8_t *sync = memchr(rx.buf, VENDOR_SYNC, rx.len);
+            rx_consume(sync ? sync - rx.buf : rx.len);
+            continue;
+        }
+
+        if (rx.len < 4) {
+            return;
+        }
+
+        uint16_t len = rx.buf[2] | (rx.buf[3] << 8);
+        if (len > VENDOR_MAX_PAYLOAD) {
+            rx_consume(1); // bad length, resync
+            continue;
+        }
+
+        if (rx.len < len + FRAME_OVERHEAD) {
+            return;
+        }
+
+        uint8_t sum = 0;
+        for (int i = 1; i < len + 4; i++) {
+            sum += rx.buf[i];
+        }
+
+        if (sum == rx.buf[len + 4]) {
+            handle_frame(rx.buf[1], rx.buf + 4, len);
+        } else {
+            reply(rx.buf[1], VENDOR_ERR_CHECKSUM, NULL, 0);
+        }
+        rx_consume(len + FRAME_OVERHEAD);
+    }
+}
+
+static void run_stream()
+{
+    if (stream.interval_us == 0) {
+        return;
+    }
+
+    uint64_t now = time_us_64();
+    if (now - stream.last < stream.interval_us) {
+        return;
+    }
+    stream.last = now;
+
+    struct __attribute__((packed)) {
+        uint32_t time_us;
+        uint8_t air;
+        uint8_t buttons;
+        uint8_t tof_num;
+        uint16_t tof[16];
+    } data = { .time_us = now, .air = air_bitmap() };
+
+    for (int i = 0; i < button_num(); i++) {
+        data.buttons |= button_pressed(i) << i;
+    }
+
+    data.tof_num = air_num() < 16 ? air_num() : 16;
+    for (int i = 0; i < data.tof_num; i++) {
+        data.tof[i] = air_raw(i);
+    }
+
+    send_frame(VENDOR_CMD_SENSOR_DATA, &data,
+               sizeof(data) - (16 - data.tof_num) * sizeof(data.tof[0]));
+}
+
+void vendor_init()
+{
+    rx.len = 0;
+    stream.interval_us = 0;
+}
+
+void vendor_update()
+{
+    if (!tud_vendor_n_mounted(VENDOR_ITF)) {
+        stream.interval_us = 0;
+        return;
+    }
+
+    while (tud_vendor_n_available(VENDOR_ITF) && (rx.len < sizeof(rx.buf))) {
+        rx.len += tud_vendor_n_read(VENDOR_ITF, rx.buf + rx.len,
+                                    sizeof(rx.buf) - rx.len);
+        parse_frames();
+    }
+
+    run_stream();
+}
+
+#else
+
+void vendor_init()
+{
+}
+
+void vendor_update()
+{
+}
+
+#endif
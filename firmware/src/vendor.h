@@ -0,0 +1,57 @@
+/*
+ * Chu Controller Vendor Bulk Interface
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef VENDOR_H
+#define VENDOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Frame: sync, cmd, len (LE16), payload[len], checksum (sum of cmd..payload)
+ * Replies use the request cmd with VENDOR_REPLY set, payload[0] is status.
+ */
+#define VENDOR_SYNC 0xc5
+#define VENDOR_REPLY 0x80
+#define VENDOR_MAX_PAYLOAD 500
+
+enum {
+    VENDOR_CMD_PING = 0x01,
+    VENDOR_CMD_CFG_READ = 0x10,
+    VENDOR_CMD_CFG_WRITE = 0x11,
+    VENDOR_CMD_CFG_EXPORT = 0x12, // whole config snapshot, see save_export()
+    VENDOR_CMD_CFG_IMPORT = 0x13,
+    VENDOR_CMD_SENSOR_STREAM = 0x20,
+    VENDOR_CMD_LED_FRAME = 0x30,
+    VENDOR_CMD_LED_STREAM = 0x31,
+    VENDOR_CMD_TRACE_CTRL = 0x40, // see trace.h, needs a CHU_TRACE build
+    VENDOR_CMD_TRACE_READ = 0x41,
+    VENDOR_CMD_SENSOR_DATA = 0x21 | VENDOR_REPLY, // unsolicited stream
+};
+
+/* LED_STREAM payload: flags, index, RGB triples */
+#define VENDOR_LED_COMMIT 0x01 // frame complete, show it
+#define VENDOR_LED_QUIET 0x02 // no reply
+
+/* TRACE_CTRL payload: one of these */
+enum {
+    VENDOR_TRACE_RESUME = 0,
+    VENDOR_TRACE_PAUSE,
+    VENDOR_TRACE_CLEAR,
+};
+
+/* TRACE_READ payload: core, index (LE16),
+   reply: total (LE16), trace_event_t from index, oldest first */
+
+enum {
+    VENDOR_OK = 0,
+    VENDOR_ERR_CHECKSUM,
+    VENDOR_ERR_UNKNOWN_CMD,
+    VENDOR_ERR_PARAM,
+};
+
+void vendor_init();
+void vendor_update();
+
+#endif
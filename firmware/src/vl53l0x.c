@@ -40,18 +40,32 @@ static struct {
 
 #define INSTANCE_NUM (sizeof(instances) / sizeof(instances[0]))
 
+static uint32_t io_errors;
+
+static inline void check_io(int ret)
+{
+    if (ret < 0) {
+        io_errors++;
+    }
+}
+
+uint32_t vl53l0x_errors()
+{
+    return io_errors;
+}
+
 // Write an 8-bit register
 void write_reg(uint8_t reg, uint8_t value)
 {
     uint8_t data[2] = { reg, value };
-    i2c_write_blocking_until(I2C_PORT, addr, data, 2, false, time_us_64() + IO_TIMEOUT_US);
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, data, 2, false, time_us_64() + IO_TIMEOUT_US));
 }
 
 // Write a 16-bit register
 void write_reg16(uint8_t reg, uint16_t value)
 {
     uint8_t data[3] = { reg, value >> 8, value & 0xff };
-    i2c_write_blocking_until(I2C_PORT, addr, data, 3, false, time_us_64() + IO_TIMEOUT_US);
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, data, 3, false, time_us_64() + IO_TIMEOUT_US));
 }
 
 static void write_reg_list(const uint16_t *list)
@@ -65,18 +79,18 @@ static void write_reg_list(const uint16_t *list)
 // Read an 8-bit register
 uint8_t read_reg(uint8_t reg)
 {
-    uint8_t value;
-    i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US);
-    i2c_read_blocking_until(I2C_PORT, addr, &value, 1, false, time_us_64() + IO_TIMEOUT_US);
+    uint8_t value = 0;
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US));
+    check_io(i2c_read_blocking_until(I2C_PORT, addr, &value, 1, false, time_us_64() + IO_TIMEOUT_US));
     return value;
 }
 
 // Read a 16-bit register
 uint16_t read_reg16(uint8_t reg)
 {
-    uint8_t value[2];
-    i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US);
-    i2c_read_blocking_until(I2C_PORT, addr, value, 2, false, time_us_64() + IO_TIMEOUT_US);
+    uint8_t value[2] = {0};
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US));
+    check_io(i2c_read_blocking_until(I2C_PORT, addr, value, 2, false, time_us_64() + IO_TIMEOUT_US));
     return (value[0] << 8) | value[1];
 }
 
@@ -84,16 +98,16 @@ uint16_t read_reg16(uint8_t reg)
 // starting at the given register
 void write_many(uint8_t reg, const uint8_t *src, uint8_t len)
 {
-    i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US);
-    i2c_write_blocking_until(I2C_PORT, addr, src, len, false, time_us_64() + IO_TIMEOUT_US);
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US));
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, src, len, false, time_us_64() + IO_TIMEOUT_US));
 }
 
 // Read an arbitrary number of bytes from the sensor, starting at the given
 // register, into the given array
 void read_many(uint8_t reg, uint8_t *dst, uint8_t len)
 {
-    i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US);
-    i2c_read_blocking_until(I2C_PORT, addr, dst, len, false, time_us_64() + IO_TIMEOUT_US * len);
+    check_io(i2c_write_blocking_until(I2C_PORT, addr, &reg, 1, true, time_us_64() + IO_TIMEOUT_US));
+    check_io(i2c_read_blocking_until(I2C_PORT, addr, dst, len, false, time_us_64() + IO_TIMEOUT_US * len));
 }
 
 
@@ -117,6 +117,7 @@ bool setVcselPulsePeriod(int index, vcselPeriodType type, uint8_t period_pclks);
 uint8_t getVcselPulsePeriod(vcselPeriodType type);
 
 void vl53l0x_start_continuous(int index);
+uint32_t vl53l0x_errors(); // failed I2C transfers
 void vl53l0x_stop_continuous(int index);
 
 uint16_t readRangeContinuousMillimeters(int index);
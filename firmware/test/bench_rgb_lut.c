@@ -0,0 +1,125 @@
+/*
+ * LED Colour Conversion Benchmark
+ * WHowe <github.com/whowechina>
+ *
+ * Pixels per second of the old per-pixel level math against the tables,
+ * converting BRG frames the way rgb_set_brg() does. Also checks that the
+ * tables give the same colours as the old math.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "test.h"
+#include "rgb_lut.h"
+
+#define FRAME_LEDS 47
+#define FRAMES 200000
+
+static uint8_t brg[FRAME_LEDS * 3];
+static uint32_t out[FRAME_LEDS];
+static volatile uint32_t sink; // keeps the loops from being optimized away
+
+/* what rgb.c did before the tables */
+static inline uint32_t old_rgb32(uint32_t c1, uint32_t c2, uint32_t c3, bool gamma_fix)
+{
+    if (gamma_fix) {
+        c1 = ((c1 + 1) * (c1 + 1) - 1) >> 8;
+        c2 = ((c2 + 1) * (c2 + 1) - 1) >> 8;
+        c3 = ((c3 + 1) * (c3 + 1) - 1) >> 8;
+    }
+    return (c1 << 16) | (c2 << 8) | (c3 << 0);
+}
+
+static inline uint32_t old_apply_level(uint32_t color, uint8_t level)
+{
+    unsigned r = (color >> 16) & 0xff;
+    unsigned g = (color >> 8) & 0xff;
+    unsigned b = color & 0xff;
+
+    r = r * level / 255;
+    g = g * level / 255;
+    b = b * level / 255;
+
+    return r << 16 | g << 8 | b;
+}
+
+/* level is read through a pointer like chu_cfg->style.level was */
+static void old_convert(const volatile uint8_t *level, bool gamma)
+{
+    for (int i = 0; i < FRAME_LEDS; i++) {
+        const uint8_t *p = brg + i * 3;
+        out[i] = old_apply_level(old_rgb32(p[1], p[2], p[0], gamma), *level);
+    }
+}
+
+static void lut_convert(const rgb_lut_t *lut)
+{
+    for (int i = 0; i < FRAME_LEDS; i++) {
+        const uint8_t *p = brg + i * 3;
+        uint32_t frac;
+        out[i] = rgb_lut_apply(lut, p[1], p[2], p[0], &frac);
+    }
+}
+
+static double now_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void check_same(uint8_t level, bool gamma)
+{
+    static const uint8_t white[3] = { 255, 255, 255 };
+    rgb_lut_t lut;
+    rgb_lut_build(&lut, level, gamma, white);
+
+    for (int v = 0; v < 256; v++) {
+        uint32_t frac;
+        uint32_t color = rgb_lut_apply(&lut, v, v, v, &frac);
+        uint32_t expect = old_apply_level(old_rgb32(v, v, v, gamma), level);
+        CHECK_EQ(color, expect);
+    }
+}
+
+int main()
+{
+    for (int i = 0; i < sizeof(brg); i++) {
+        brg[i] = i * 37;
+    }
+
+    for (int level = 0; level < 256; level += 17) {
+        check_same(level, false);
+    }
+
+    volatile uint8_t level = 100;
+    static const uint8_t white[3] = { 255, 240, 220 };
+    rgb_lut_t lut;
+    rgb_lut_build(&lut, level, true, white);
+
+    double start = now_s();
+    for (int i = 0; i < FRAMES; i++) {
+        brg[i % sizeof(brg)]++;
+        old_convert(&level, true);
+        sink += out[i % FRAME_LEDS];
+    }
+    double old_time = now_s() - start;
+
+    start = now_s();
+    for (int i = 0; i < FRAMES; i++) {
+        brg[i % sizeof(brg)]++;
+        lut_convert(&lut);
+        sink += out[i % FRAME_LEDS];
+    }
+    double lut_time = now_s() - start;
+
+    double pixels = (double)FRAMES * FRAME_LEDS;
+    printf("per-pixel math: %.1f Mpixel/s\n", pixels / old_time / 1e6);
+    printf("tables:         %.1f Mpixel/s (%.1fx)\n", pixels / lut_time / 1e6,
+           old_time / lut_time);
+
+    return test_done("rgb_lut bench");
+}
@@ -0,0 +1,239 @@
+/*
+ * Scripted PN532 Stand-in
+ * WHowe <github.com/whowechina>
+ *
+ * Implements the pn532.h calls card.c makes, against a card in RAM. Like
+ * the real driver, a command in flight only answers to its owner.
+ */
+
+#include "fake_pn532.h"
+
+#include <string.h>
+
+#include "pn532.h"
+
+fake_pn532_stats_t fake_pn532;
+
+enum {
+    OP_NONE = 0,
+    OP_RF,
+    OP_POLL_MIFARE,
+    OP_POLL_14443B,
+    OP_POLL_FELICA,
+    OP_AUTH,
+    OP_READ,
+    OP_FELICA_READ,
+    OP_COMMAND,
+};
+
+static int latency;
+static const fake_card_t *field;
+static int auth_sector = -1;
+static uint8_t caller;
+
+static struct {
+    int op;
+    uint8_t owner;
+    int left;
+} pending;
+
+void fake_pn532_reset(int busy_calls)
+{
+    memset(&fake_pn532, 0, sizeof(fake_pn532));
+    memset(&pending, 0, sizeof(pending));
+    latency = busy_calls;
+    field = NULL;
+    auth_sector = -1;
+}
+
+void fake_pn532_place(const fake_card_t *card)
+{
+    field = card;
+    auth_sector = -1;
+}
+
+/* PN532_BUSY until the command has taken its time, then PN532_OK */
+static int step(int op)
+{
+    if (pending.op == OP_NONE) {
+        pending.op = op;
+        pending.owner = caller;
+        pending.left = latency;
+    } else if ((pending.op != op) || (pending.owner != caller)) {
+        fake_pn532.owner_errors++;
+        return PN532_FAIL;
+    }
+    if (pending.left-- > 0) {
+        return PN532_BUSY;
+    }
+    pending.op = OP_NONE;
+    return PN532_OK;
+}
+
+void pn532_set_owner(uint8_t owner)
+{
+    caller = owner;
+}
+
+bool pn532_busy()
+{
+    return pending.op != OP_NONE;
+}
+
+uint32_t pn532_firmware_ver()
+{
+    return 0x32010607;
+}
+
+bool pn532_config_sam()
+{
+    return true;
+}
+
+bool pn532_config_rf()
+{
+    return true;
+}
+
+int pn532_set_rf_field_async(uint8_t auto_rf, uint8_t on_off)
+{
+    return step(OP_RF);
+}
+
+static int poll_type(int op, card_type_t type, uint8_t *uid, int *len)
+{
+    int ret = step(op);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+    fake_pn532.polls++;
+    if (!field || (field->type != type) || (*len < field->uid_len)) {
+        return PN532_FAIL;
+    }
+    memcpy(uid, field->uid, field->uid_len);
+    *len = field->uid_len;
+    auth_sector = -1;
+    return PN532_OK;
+}
+
+int pn532_poll_mifare_async(uint8_t *uid, int *len)
+{
+    return poll_type(OP_POLL_MIFARE, CARD_MIFARE, uid, len);
+}
+
+int pn532_poll_14443b_async(uint8_t *uid, int *len)
+{
+    return poll_type(OP_POLL_14443B, CARD_14443B, uid, len);
+}
+
+int pn532_poll_felica_async(uint8_t uid[8], uint8_t pmm[8], uint8_t syscode[2], bool from_cache)
+{
+    int len = 8;
+    int ret = poll_type(OP_POLL_FELICA, CARD_FELICA, uid, &len);
+    if (ret == PN532_OK) {
+        memcpy(pmm, field->pmm, 8);
+        memcpy(syscode, field->syscode, 2);
+    }
+    return ret;
+}
+
+int pn532_mifare_auth_async(const uint8_t uid[4], uint8_t block_id, uint8_t key_id, const uint8_t *key)
+{
+    int ret = step(OP_AUTH);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+    fake_pn532.auths++;
+    if (!field || (field->type != CARD_MIFARE) ||
+        (memcmp(uid, field->uid, 4) != 0) || (key_id != field->key_id) ||
+        (memcmp(key, field->key, 6) != 0)) {
+        auth_sector = -1;
+        return PN532_FAIL;
+    }
+    auth_sector = block_id / 4;
+    return PN532_OK;
+}
+
+int pn532_mifare_read_blocks_async(uint8_t block_id, uint8_t num, uint8_t *block_data)
+{
+    int ret = step(OP_READ);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+    for (int i = 0; i < num; i++) {
+        int block = block_id + i;
+        if (!field || (block >= 64) || (block / 4 != auth_sector)) {
+            return PN532_FAIL;
+        }
+        memcpy(block_data + i * 16, field->blocks[block], 16);
+        fake_pn532.block_reads++;
+    }
+    return PN532_OK;
+}
+
+static bool felica_block(uint16_t elem, uint8_t *data)
+{
+    uint8_t n = elem & 0xff;
+    if (((elem >> 8) != 0x80) || (n >= 64)) {
+        return false;
+    }
+    memcpy(data, field->blocks[n], 16);
+    fake_pn532.felica_reads++;
+    return true;
+}
+
+int pn532_felica_read_blocks_async(uint16_t svc_code, uint8_t num,
+                                   const uint16_t *block_ids, uint8_t *block_data)
+{
+    int ret = step(OP_FELICA_READ);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+    if (!field || (field->type != CARD_FELICA)) {
+        return PN532_FAIL;
+    }
+    for (int i = 0; i < num; i++) {
+        if (!felica_block(block_ids[i], block_data + i * 16)) {
+            return PN532_FAIL;
+        }
+    }
+    return PN532_OK;
+}
+
+/* InDataExchange with a raw FeliCa frame, only Read Without Encryption */
+int pn532_command_async(uint8_t cmd, const uint8_t *param, uint8_t len,
+                        uint8_t *resp, uint8_t resp_len)
+{
+    int ret = step(OP_COMMAND);
+    if (ret != PN532_OK) {
+        return ret;
+    }
+
+    const uint8_t *frame = param + 1;
+    if ((cmd != 0x40) || !field || (field->type != CARD_FELICA) ||
+        (frame[1] != 0x06) || (memcmp(frame + 2, field->uid, 8) != 0)) {
+        return PN532_FAIL;
+    }
+
+    uint8_t num = frame[13];
+    uint8_t *reply = resp + 1;
+    int reply_len = 13 + num * 16;
+    if (reply_len + 1 > resp_len) {
+        return PN532_FAIL;
+    }
+
+    resp[0] = 0; // InDataExchange status
+    reply[0] = reply_len;
+    reply[1] = 0x07;
+    memcpy(reply + 2, field->uid, 8);
+    reply[10] = 0;
+    reply[11] = 0;
+    reply[12] = num;
+    for (int i = 0; i < num; i++) {
+        uint16_t elem = (frame[14 + i * 2] << 8) | frame[15 + i * 2];
+        if (!felica_block(elem, reply + 13 + i * 16)) {
+            return PN532_FAIL;
+        }
+    }
+    return reply_len + 1;
+}
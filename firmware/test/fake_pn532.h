@@ -0,0 +1,39 @@
+/*
+ * Scripted PN532 Stand-in
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef FAKE_PN532_H
+#define FAKE_PN532_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "card.h"
+
+typedef struct {
+    card_type_t type;
+    uint8_t uid[10]; // FeliCa IDm is uid[0..7]
+    uint8_t uid_len;
+    uint8_t pmm[8];
+    uint8_t syscode[2];
+    uint8_t key_id; // MIFARE, key that opens every sector
+    uint8_t key[6];
+    uint8_t blocks[64][16]; // MIFARE block n, or FeliCa block element 0x80 n
+} fake_card_t;
+
+typedef struct {
+    uint32_t polls;
+    uint32_t auths;
+    uint32_t block_reads; // MIFARE blocks read off the card
+    uint32_t felica_reads; // FeliCa blocks read off the card
+    uint32_t owner_errors; // a call stepped a command it didn't start
+} fake_pn532_stats_t;
+
+extern fake_pn532_stats_t fake_pn532;
+
+/* Every command answers after `latency` PN532_BUSY calls */
+void fake_pn532_reset(int latency);
+void fake_pn532_place(const fake_card_t *card); // NULL takes it away
+
+#endif
@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for bsp/board.h, nothing in it is used
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef BSP_BOARD_H
+#define BSP_BOARD_H
+
+#endif
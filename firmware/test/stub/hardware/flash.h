@@ -0,0 +1,22 @@
+/*
+ * Host stand-in for hardware/flash.h, the test provides the flash model
+ * and maps it where XIP would be
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef HARDWARE_FLASH_H
+#define HARDWARE_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+#define PICO_FLASH_SIZE_BYTES (16 * FLASH_SECTOR_SIZE)
+
+extern uint8_t *flash_model;
+#define XIP_BASE ((uintptr_t)flash_model)
+
+void flash_range_erase(uint32_t offset, size_t count);
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count);
+
+#endif
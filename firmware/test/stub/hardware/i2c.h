@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for hardware/i2c.h
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef HARDWARE_I2C_H
+#define HARDWARE_I2C_H
+
+#include "pico/stdlib.h"
+
+typedef struct i2c_inst i2c_inst_t;
+extern i2c_inst_t *i2c0;
+extern i2c_inst_t *i2c1;
+
+int i2c_write_blocking_until(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                             size_t len, bool nostop, uint64_t until);
+
+#endif
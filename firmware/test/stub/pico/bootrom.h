@@ -0,0 +1,9 @@
+/*
+ * Host stand-in for pico/bootrom.h, nothing in it is used
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PICO_BOOTROM_H
+#define PICO_BOOTROM_H
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for pico/multicore.h, with the mutex and interrupt calls
+ * it brings along in the real SDK
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PICO_MULTICORE_H
+#define PICO_MULTICORE_H
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    bool owned;
+} mutex_t;
+
+bool mutex_enter_timeout_us(mutex_t *mtx, uint32_t timeout_us);
+void mutex_exit(mutex_t *mtx);
+
+bool multicore_lockout_victim_is_initialized(unsigned core);
+bool multicore_lockout_start_timeout_us(uint64_t timeout_us);
+void multicore_lockout_end_blocking();
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+#endif
@@ -0,0 +1,11 @@
+/*
+ * Host stand-in for pico/stdio.h
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PICO_STDIO_H
+#define PICO_STDIO_H
+
+#include <stdio.h>
+
+#endif
@@ -0,0 +1,18 @@
+/*
+ * Host stand-in for the bits of pico-sdk the tested modules use
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef PICO_STDLIB_H
+#define PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+uint64_t time_us_64(); // the test drives the clock
+static inline void tight_loop_contents() {}
+
+#endif
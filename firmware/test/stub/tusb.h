@@ -0,0 +1,17 @@
+/*
+ * Host stand-in for the TinyUSB CDC calls
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef TUSB_H
+#define TUSB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+uint32_t tud_cdc_n_available(uint8_t itf);
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize);
+uint32_t tud_cdc_n_write_flush(uint8_t itf);
+
+#endif
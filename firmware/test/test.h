@@ -0,0 +1,35 @@
+/*
+ * Host Test Helpers
+ * WHowe <github.com/whowechina>
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        test_failures++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    long long _a = (a), _b = (b); \
+    if (_a != _b) { \
+        printf("%s:%d: %s == %s failed, %lld vs %lld\n", \
+               __FILE__, __LINE__, #a, #b, _a, _b); \
+        test_failures++; \
+    } \
+} while (0)
+
+static inline int test_done(const char *name)
+{
+    printf("%s: %s\n", name, test_failures ? "FAILED" : "passed");
+    return test_failures ? 1 : 0;
+}
+
+#endif
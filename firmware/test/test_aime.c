@@ -0,0 +1,487 @@
+/*
+ * AIME Reader Protocol Server Tests
+ * WHowe <github.com/whowechina>
+ *
+ * aime.c and card.c as they are, over a scripted PN532 and an in-memory
+ * CDC port.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "fake_pn532.h"
+
+#include "aime.h"
+#include "card.h"
+#include "config.h"
+#include "tusb.h"
+#include "hardware/i2c.h"
+
+#define AIME_SYNC 0xe0
+#define AIME_ESCAPE 0xd0
+
+/* the rest of the firmware, as far as aime.c and card.c see it */
+static chu_cfg_t cfg = { .nfc = { .poll_ms = 20, .ttl_ms = 200 } };
+chu_cfg_t *chu_cfg = &cfg;
+
+static uint64_t now;
+uint64_t time_us_64()
+{
+    return now;
+}
+
+i2c_inst_t *i2c0;
+i2c_inst_t *i2c1;
+static int i2c_writes;
+int i2c_write_blocking_until(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src,
+                             size_t len, bool nostop, uint64_t until)
+{
+    i2c_writes++;
+    return len;
+}
+
+static struct {
+    uint8_t buf[1024];
+    int len;
+    int pos;
+} to_dev, to_host;
+
+uint32_t tud_cdc_n_available(uint8_t itf)
+{
+    return (itf == 2) ? to_dev.len - to_dev.pos : 0;
+}
+
+uint32_t tud_cdc_n_read(uint8_t itf, void *buffer, uint32_t bufsize)
+{
+    uint32_t len = tud_cdc_n_available(itf);
+    len = len < bufsize ? len : bufsize;
+    memcpy(buffer, to_dev.buf + to_dev.pos, len);
+    to_dev.pos += len;
+    return len;
+}
+
+uint32_t tud_cdc_n_write(uint8_t itf, const void *buffer, uint32_t bufsize)
+{
+    if ((itf != 2) || (to_host.len + bufsize > sizeof(to_host.buf))) {
+        return 0;
+    }
+    memcpy(to_host.buf + to_host.len, buffer, bufsize);
+    to_host.len += bufsize;
+    return bufsize;
+}
+
+uint32_t tud_cdc_n_write_flush(uint8_t itf)
+{
+    return 0;
+}
+
+/* host side of the protocol */
+static void put_escaped(uint8_t c)
+{
+    if ((c == AIME_SYNC) || (c == AIME_ESCAPE)) {
+        to_dev.buf[to_dev.len++] = AIME_ESCAPE;
+        c--;
+    }
+    to_dev.buf[to_dev.len++] = c;
+}
+
+static void send_request(uint8_t seq, uint8_t cmd, const uint8_t *payload,
+                         uint8_t len, uint8_t sum_error)
+{
+    uint8_t raw[5] = { 5 + len, 0, seq, cmd, len };
+    uint8_t sum = 0;
+
+    to_dev.len = 0;
+    to_dev.pos = 0;
+    to_dev.buf[to_dev.len++] = AIME_SYNC;
+    for (int i = 0; i < 5; i++) {
+        put_escaped(raw[i]);
+        sum += raw[i];
+    }
+    for (int i = 0; i < len; i++) {
+        put_escaped(payload[i]);
+        sum += payload[i];
+    }
+    put_escaped(sum + sum_error);
+}
+
+typedef struct {
+    bool got;
+    uint8_t seq;
+    uint8_t cmd;
+    uint8_t status;
+    uint8_t len;
+    uint8_t payload[256];
+    int updates; // aime_update() calls until the response was out
+} response_t;
+
+static void run(int loops)
+{
+    for (int i = 0; i < loops; i++) {
+        aime_update();
+        now += 100;
+    }
+}
+
+static bool decode_response(response_t *resp)
+{
+    uint8_t raw[260];
+    int len = 0;
+
+    if ((to_host.len < 1) || (to_host.buf[0] != AIME_SYNC)) {
+        return false;
+    }
+    for (int i = 1; i < to_host.len; i++) {
+        uint8_t c = to_host.buf[i];
+        if (c == AIME_SYNC) {
+            return false; // never unescaped after the sync
+        }
+        if (c == AIME_ESCAPE) {
+            c = to_host.buf[++i] + 1;
+        }
+        raw[len++] = c;
+    }
+
+    if ((len < 7) || (raw[0] + 1 != len)) {
+        return false;
+    }
+    uint8_t sum = 0;
+    for (int i = 0; i < raw[0]; i++) {
+        sum += raw[i];
+    }
+    if ((sum != raw[raw[0]]) || (raw[5] + 6 != raw[0])) {
+        return false;
+    }
+
+    resp->seq = raw[2];
+    resp->cmd = raw[3];
+    resp->status = raw[4];
+    resp->len = raw[5];
+    memcpy(resp->payload, raw + 6, raw[5]);
+    return true;
+}
+
+static response_t transact_err(uint8_t cmd, const uint8_t *payload, uint8_t len,
+                               uint8_t sum_error)
+{
+    static uint8_t seq;
+    response_t resp = { 0 };
+
+    seq++;
+    send_request(seq, cmd, payload, len, sum_error);
+    to_host.len = 0;
+
+    for (int i = 0; i < 1000; i++) {
+        aime_update();
+        now += 100;
+        if (to_host.len > 0) {
+            resp.got = decode_response(&resp);
+            resp.updates = i + 1;
+            CHECK(resp.got);
+            CHECK_EQ(resp.seq, seq);
+            CHECK_EQ(resp.cmd, cmd);
+            return resp;
+        }
+    }
+    return resp;
+}
+
+static response_t transact(uint8_t cmd, const uint8_t *payload, uint8_t len)
+{
+    return transact_err(cmd, payload, len, 0);
+}
+
+static fake_card_t mifare = {
+    .type = CARD_MIFARE,
+    .uid = { 0x12, 0x34, 0x56, 0x78 },
+    .uid_len = 4,
+    .key_id = 0,
+    .key = { 0x57, 0x43, 0x43, 0x46, 0x76, 0x32 },
+};
+
+static fake_card_t felica = {
+    .type = CARD_FELICA,
+    .uid = { 0x01, 0x2e, 0x4c, 0xd0, 0xe0, 0x11, 0x22, 0x33 },
+    .uid_len = 8,
+    .pmm = { 0x00, 0xf1, 0x00, 0x00, 0x00, 0x01, 0x43, 0x00 },
+    .syscode = { 0x88, 0xb4 },
+};
+
+static void fill_blocks(fake_card_t *card, uint8_t seed)
+{
+    for (int i = 0; i < 64; i++) {
+        for (int j = 0; j < 16; j++) {
+            card->blocks[i][j] = seed + i * 16 + j;
+        }
+    }
+}
+
+static void wait_for_card(const fake_card_t *card)
+{
+    fake_pn532_place(card);
+    for (int i = 0; i < 20000; i++) {
+        run(1);
+        const card_t *seen = card_current();
+        if (card ? (seen && (seen->type == card->type)) : !seen) {
+            return;
+        }
+    }
+    CHECK(false);
+}
+
+static void test_framing()
+{
+    response_t resp = transact(0x30, NULL, 0); // firmware version
+    CHECK_EQ(resp.status, 0);
+    CHECK_EQ(resp.len, 23);
+    CHECK(memcmp(resp.payload, "TN32MSEC003S F/W Ver1.2", 23) == 0);
+
+    resp = transact(0x32, NULL, 0); // hardware version
+    CHECK_EQ(resp.status, 0);
+    CHECK(memcmp(resp.payload, "TN32MSEC003S H/W Ver3.0", 23) == 0);
+}
+
+static void test_escaping()
+{
+    /* a key full of sync and escape bytes, it must arrive intact */
+    static const uint8_t key[6] = { 0xe0, 0xd0, 0xdf, 0xcf, 0xe0, 0xd0 };
+    response_t resp = transact(0x50, key, 6);
+    CHECK_EQ(resp.status, 0);
+
+    fake_card_t card = mifare;
+    memcpy(card.key, key, 6);
+    wait_for_card(&card);
+
+    uint8_t auth[5] = { 0x12, 0x34, 0x56, 0x78, 4 };
+    resp = transact(0x51, auth, 5);
+    CHECK_EQ(resp.status, 0);
+
+    /* replies with sync and escape bytes in them, and a wrong sum */
+    for (int seq = 0; seq < 300; seq++) {
+        send_request(seq, 0x99, NULL, 0, 0);
+        to_host.len = 0;
+        run(3);
+        response_t r;
+        CHECK(decode_response(&r));
+        CHECK_EQ(r.seq, seq & 0xff);
+        CHECK_EQ(r.status, 3); // invalid command
+    }
+
+    resp = transact_err(0x30, NULL, 0, 1);
+    CHECK_EQ(resp.status, 5); // sum error
+    CHECK_EQ(resp.len, 0);
+
+    wait_for_card(NULL);
+}
+
+static void test_dispatch()
+{
+    response_t resp = transact(0x99, NULL, 0);
+    CHECK_EQ(resp.status, 3);
+
+    resp = transact(0x62, NULL, 0); // to normal mode
+    CHECK_EQ(resp.status, 3);
+
+    resp = transact(0x61, NULL, 0); // firmware hex data
+    CHECK_EQ(resp.status, 32);
+
+    uint8_t short_key[3] = { 1, 2, 3 };
+    resp = transact(0x54, short_key, 3);
+    CHECK_EQ(resp.status, 4); // invalid data
+
+    resp = transact(0xf0, NULL, 0); // LED board info
+    CHECK_EQ(resp.status, 0);
+    CHECK_EQ(resp.len, 9);
+    CHECK(memcmp(resp.payload, "15084\xff\x10\x00\x12", 9) == 0);
+
+    resp = transact(0xf5, NULL, 0);
+    CHECK_EQ(resp.len, 1);
+
+    /* LED commands get no answer */
+    uint8_t rgb[3] = { 0xff, 0x00, 0x80 };
+    send_request(1, 0x81, rgb, 3, 0);
+    to_host.len = 0;
+    run(10);
+    CHECK_EQ(to_host.len, 0);
+
+    resp = transact(0x42, NULL, 0); // no card
+    CHECK_EQ(resp.status, 0);
+    CHECK_EQ(resp.len, 1);
+    CHECK_EQ(resp.payload[0], 0);
+}
+
+static void test_mifare()
+{
+    fill_blocks(&mifare, 0x40);
+    wait_for_card(&mifare);
+
+    response_t resp = transact(0x42, NULL, 0);
+    CHECK_EQ(resp.len, 7);
+    CHECK_EQ(resp.payload[0], 1);
+    CHECK_EQ(resp.payload[1], 0x10);
+    CHECK_EQ(resp.payload[2], 4);
+    CHECK(memcmp(resp.payload + 3, mifare.uid, 4) == 0);
+
+    resp = transact(0x50, mifare.key, 6);
+    CHECK_EQ(resp.status, 0);
+
+    uint8_t req[5] = { 0x12, 0x34, 0x56, 0x78, 1 };
+    resp = transact(0x51, req, 5);
+    CHECK_EQ(resp.status, 0);
+    CHECK(resp.updates > 1); // answered over several loops, never waited on
+
+    for (int block = 1; block <= 2; block++) {
+        req[4] = block;
+        resp = transact(0x52, req, 5);
+        CHECK_EQ(resp.status, 0);
+        CHECK_EQ(resp.len, 16);
+        CHECK(memcmp(resp.payload, mifare.blocks[block], 16) == 0);
+    }
+
+    /* a second card session on the same card comes from the cache */
+    uint32_t reads = fake_pn532.block_reads;
+    req[4] = 1;
+    resp = transact(0x52, req, 5);
+    CHECK_EQ(resp.status, 0);
+    CHECK(memcmp(resp.payload, mifare.blocks[1], 16) == 0);
+    CHECK_EQ(fake_pn532.block_reads, reads);
+
+    /* wrong key */
+    uint8_t bad_key[6] = { 0 };
+    transact(0x54, bad_key, 6);
+    req[4] = 8;
+    resp = transact(0x55, req, 5);
+    CHECK_EQ(resp.status, 1);
+
+    /* reading a sector that isn't authenticated */
+    req[4] = 9;
+    resp = transact(0x52, req, 5);
+    CHECK_EQ(resp.status, 1);
+
+    wait_for_card(NULL);
+}
+
+static void test_mifare_prefetch()
+{
+    /* blocks the host read before are cached as soon as the card shows up */
+    fake_card_t card = mifare;
+    card.uid[0] = 0x99;
+    fill_blocks(&card, 0x80);
+    wait_for_card(&card);
+    run(200);
+
+    uint32_t reads = fake_pn532.block_reads;
+    transact(0x50, card.key, 6);
+    uint8_t req[5] = { 0x99, 0x34, 0x56, 0x78, 1 };
+    response_t resp = transact(0x51, req, 5);
+    CHECK_EQ(resp.status, 0);
+    resp = transact(0x52, req, 5);
+    CHECK_EQ(resp.status, 0);
+    CHECK(memcmp(resp.payload, card.blocks[1], 16) == 0);
+    CHECK_EQ(fake_pn532.block_reads, reads);
+
+    wait_for_card(NULL);
+}
+
+/* Read Without Encryption of service 0x000b, blocks 0x8000 and 0x8082 */
+static response_t felica_read(const uint8_t idm[8])
+{
+    uint8_t req[9 + 18] = { 0 };
+    memcpy(req, idm, 8);
+    req[8] = 18;
+    uint8_t *frame = req + 9;
+    frame[0] = 18;
+    frame[1] = 0x06;
+    memcpy(frame + 2, idm, 8);
+    frame[10] = 1;
+    frame[11] = 0x0b;
+    frame[12] = 0x00;
+    frame[13] = 2;
+    frame[14] = 0x80;
+    frame[15] = 0x00;
+    frame[16] = 0x80;
+    frame[17] = 0x02;
+    return transact(0x71, req, sizeof(req));
+}
+
+static void test_felica()
+{
+    fill_blocks(&felica, 0x10);
+    wait_for_card(&felica);
+
+    response_t resp = transact(0x42, NULL, 0);
+    CHECK_EQ(resp.len, 19);
+    CHECK_EQ(resp.payload[1], 0x20);
+    CHECK_EQ(resp.payload[2], 16);
+    CHECK(memcmp(resp.payload + 3, felica.uid, 8) == 0);
+    CHECK(memcmp(resp.payload + 11, felica.pmm, 8) == 0);
+
+    resp = felica_read(felica.uid);
+    CHECK_EQ(resp.status, 0);
+    CHECK_EQ(resp.len, 13 + 32);
+    CHECK_EQ(resp.payload[1], 0x07);
+    CHECK_EQ(resp.payload[12], 2);
+    CHECK(memcmp(resp.payload + 13, felica.blocks[0], 16) == 0);
+    CHECK(memcmp(resp.payload + 29, felica.blocks[2], 16) == 0);
+
+    uint32_t reads = fake_pn532.felica_reads;
+    resp = felica_read(felica.uid);
+    CHECK_EQ(resp.status, 0);
+    CHECK(memcmp(resp.payload + 29, felica.blocks[2], 16) == 0);
+    CHECK_EQ(fake_pn532.felica_reads, reads);
+
+    /* answered locally */
+    uint8_t nda[9 + 10] = { 0 };
+    memcpy(nda, felica.uid, 8);
+    nda[8] = 10;
+    nda[9] = 10;
+    nda[10] = 0xa4;
+    memcpy(nda + 11, felica.uid, 8);
+    resp = transact(0x71, nda, sizeof(nda));
+    CHECK_EQ(resp.status, 0);
+    CHECK_EQ(resp.len, 11);
+    CHECK_EQ(resp.payload[1], 0xa5);
+
+    wait_for_card(NULL);
+}
+
+static void test_idle_bus()
+{
+    /* polls are far apart, the loops in between don't touch I2C */
+    cfg.nfc.poll_ms = 1000;
+    run(20000);
+    int writes = i2c_writes;
+    int polls = fake_pn532.polls;
+    run(500);
+    if (fake_pn532.polls == polls) {
+        CHECK_EQ(i2c_writes, writes);
+    }
+    cfg.nfc.poll_ms = 20;
+
+    /* radio off, nothing at all */
+    transact(0x41, NULL, 0);
+    run(1000);
+    writes = i2c_writes;
+    run(1000);
+    CHECK_EQ(i2c_writes, writes);
+    transact(0x40, NULL, 0);
+}
+
+int main()
+{
+    fake_pn532_reset(5);
+    aime_init();
+
+    test_framing();
+    test_escaping();
+    test_dispatch();
+    test_mifare();
+    test_mifare_prefetch();
+    test_felica();
+    test_idle_bus();
+
+    CHECK_EQ(fake_pn532.owner_errors, 0);
+    return test_done("aime");
+}
@@ -0,0 +1,133 @@
+/*
+ * PN532 Frame Tests
+ * WHowe <github.com/whowechina>
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "pn532_frame.h"
+
+/* GetFirmwareVersion and its answer, IC 0x32, ver 1.6, support 0x07 */
+static const uint8_t fw_cmd[] = { 0x00, 0x00, 0xff, 0x02, 0xfe, 0xd4, 0x02, 0x2a, 0x00 };
+static const uint8_t fw_resp[] = {
+    0x00, 0x00, 0xff, 0x06, 0xfa, 0xd5, 0x03, 0x32, 0x01, 0x06, 0x07, 0xe8, 0x00,
+};
+
+static uint8_t frame[PN532_FRAME_MAX];
+
+static void test_build()
+{
+    int len = pn532_frame_build(frame, 0x02, 0);
+    CHECK_EQ(len, sizeof(fw_cmd));
+    CHECK(memcmp(frame, fw_cmd, sizeof(fw_cmd)) == 0);
+
+    /* SAMConfiguration normal mode */
+    static const uint8_t sam[] = {
+        0x00, 0x00, 0xff, 0x05, 0xfb, 0xd4, 0x14, 0x01, 0x14, 0x01, 0x02, 0x00,
+    };
+    frame[PN532_FRAME_PARAM] = 0x01;
+    frame[PN532_FRAME_PARAM + 1] = 0x14;
+    frame[PN532_FRAME_PARAM + 2] = 0x01;
+    len = pn532_frame_build(frame, 0x14, 3);
+    CHECK_EQ(len, sizeof(sam));
+    CHECK(memcmp(frame, sam, sizeof(sam)) == 0);
+}
+
+static void test_build_longest()
+{
+    for (int i = 0; i < 253; i++) {
+        frame[PN532_FRAME_PARAM + i] = i * 13;
+    }
+    int len = pn532_frame_build(frame, 0x40, 253);
+    CHECK_EQ(len, 9 + 253);
+    CHECK_EQ(frame[3], 255);
+    CHECK_EQ((uint8_t)(frame[3] + frame[4]), 0); // LCS
+    uint8_t sum = 0;
+    for (int i = 5; i < len - 1; i++) {
+        sum += frame[i];
+    }
+    CHECK_EQ(sum, 0); // DCS
+    CHECK_EQ(frame[len - 1], 0);
+}
+
+static void test_parse()
+{
+    const uint8_t *data = NULL;
+    int len = pn532_frame_parse(fw_resp, sizeof(fw_resp), 0x02, &data);
+    CHECK_EQ(len, 4);
+    CHECK(data == fw_resp + 7);
+    CHECK_EQ(data[0], 0x32);
+    CHECK_EQ(data[3], 0x07);
+
+    /* read with room to spare, the rest of the read is junk */
+    uint8_t buf[32];
+    memset(buf, 0xa5, sizeof(buf));
+    memcpy(buf, fw_resp, sizeof(fw_resp));
+    CHECK_EQ(pn532_frame_parse(buf, sizeof(buf), 0x02, &data), 4);
+
+    /* a frame built here parses back as the matching response */
+    frame[PN532_FRAME_PARAM] = 0x77;
+    len = pn532_frame_build(frame, 0x40, 1);
+    frame[5] = 0xd5;
+    frame[6] = 0x41;
+    frame[7 + 1] -= 0x01 + 0x01; // DCS follows the TFI and cmd change
+    CHECK_EQ(pn532_frame_parse(frame, len, 0x40, &data), 1);
+    CHECK_EQ(data[0], 0x77);
+}
+
+static int parse_broken(int index, uint8_t value, int len)
+{
+    uint8_t buf[sizeof(fw_resp)];
+    memcpy(buf, fw_resp, sizeof(buf));
+    if (index >= 0) {
+        buf[index] = value;
+    }
+    const uint8_t *data;
+    return pn532_frame_parse(buf, len, 0x02, &data);
+}
+
+static void test_malformed()
+{
+    CHECK_EQ(parse_broken(2, 0xfe, sizeof(fw_resp)), -1); // start code
+    CHECK_EQ(parse_broken(4, 0xfb, sizeof(fw_resp)), -1); // LCS
+    CHECK_EQ(parse_broken(5, 0xd4, sizeof(fw_resp)), -1); // TFI
+    CHECK_EQ(parse_broken(6, 0x05, sizeof(fw_resp)), -1); // answer to another cmd
+    CHECK_EQ(parse_broken(9, 0x07, sizeof(fw_resp)), -1); // data vs DCS
+    CHECK_EQ(parse_broken(11, 0xe9, sizeof(fw_resp)), -1); // DCS
+    CHECK_EQ(parse_broken(12, 0x01, sizeof(fw_resp)), -1); // postamble
+    CHECK_EQ(parse_broken(-1, 0, sizeof(fw_resp) - 1), -1); // cut short
+    CHECK_EQ(parse_broken(-1, 0, 4), -1);
+
+    /* length below TFI + cmd, LCS still right */
+    uint8_t buf[sizeof(fw_resp)];
+    memcpy(buf, fw_resp, sizeof(buf));
+    buf[3] = 1;
+    buf[4] = 0xff;
+    const uint8_t *data;
+    CHECK_EQ(pn532_frame_parse(buf, sizeof(buf), 0x02, &data), -1);
+
+    /* an ACK is not a response */
+    CHECK_EQ(pn532_frame_parse(pn532_ack_frame, PN532_ACK_LEN, 0x02, &data), -1);
+}
+
+static void test_ack()
+{
+    static const uint8_t ack[] = { 0x00, 0x00, 0xff, 0x00, 0xff, 0x00 };
+    static const uint8_t nack[] = { 0x00, 0x00, 0xff, 0xff, 0x00, 0x00 };
+    CHECK(pn532_frame_is_ack(ack));
+    CHECK(!pn532_frame_is_ack(nack));
+    CHECK(!pn532_frame_is_ack(fw_resp));
+}
+
+int main()
+{
+    test_build();
+    test_build_longest();
+    test_parse();
+    test_malformed();
+    test_ack();
+    return test_done("pn532_frame");
+}
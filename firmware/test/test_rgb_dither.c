@@ -0,0 +1,133 @@
+/*
+ * LED Temporal Dither Tests
+ * WHowe <github.com/whowechina>
+ *
+ * The average of dithered frames has to land on the 8.8 table value, with
+ * the 4 fraction bits rgb.c keeps (DITHER_MASK).
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "rgb_lut.h"
+
+#define DITHER_MASK 0xf0
+#define CYCLE 16 // frames for 4 fraction bits
+
+static const uint8_t neutral[3] = { 255, 255, 255 };
+
+/* sum of one channel over frames */
+static uint32_t run_channel(uint8_t v, uint8_t frac, int shift, int frames)
+{
+    uint8_t acc[3] = { 0 };
+    uint32_t sum = 0;
+    for (int i = 0; i < frames; i++) {
+        uint32_t out = rgb_dither(acc, v << shift, frac << shift);
+        sum += (out >> shift) & 0xff;
+    }
+    return sum;
+}
+
+static void test_average_matches_table()
+{
+    static const uint8_t levels[] = { 4, 10, 31, 64, 127, 200, 255 };
+    rgb_lut_t lut;
+
+    for (int l = 0; l < sizeof(levels); l++) {
+        for (int gamma = 0; gamma < 2; gamma++) {
+            rgb_lut_build(&lut, levels[l], gamma, neutral);
+            for (int v = 0; v < 256; v++) {
+                uint16_t target = lut.g[v]; // 8.8
+                uint8_t whole = target >> 8;
+                uint8_t frac = target & DITHER_MASK;
+
+                uint32_t sum = run_channel(whole, frac, 8, CYCLE);
+                /* exact over a full cycle */
+                CHECK_EQ(sum, whole * CYCLE + frac * CYCLE / 256);
+                /* and within one 1/16 step of the real target */
+                int32_t error = (int32_t)(sum * 256) - target * CYCLE;
+                CHECK((error <= 0) && (error > -256));
+            }
+        }
+    }
+}
+
+static void test_dark_colors()
+{
+    /* a level so low that truncation alone leaves only a few steps */
+    rgb_lut_t lut;
+    rgb_lut_build(&lut, 6, false, neutral);
+
+    int plain_steps = 0;
+    int dither_steps = 0;
+    uint32_t last_plain = ~0u;
+    uint32_t last_dither = ~0u;
+    for (int v = 0; v < 256; v++) {
+        uint16_t target = lut.r[v];
+        uint32_t plain = target >> 8;
+        uint32_t dithered = run_channel(target >> 8, target & DITHER_MASK, 16, CYCLE);
+        plain_steps += (plain != last_plain);
+        dither_steps += (dithered != last_dither);
+        last_plain = plain;
+        last_dither = dithered;
+    }
+    CHECK(plain_steps <= 7);
+    CHECK(dither_steps > plain_steps * 8);
+}
+
+static void test_long_run()
+{
+    /* not a whole cycle, still never off by more than one step in total */
+    for (int frac = 0; frac < 256; frac++) {
+        for (int frames = 1; frames < 100; frames += 7) {
+            uint32_t sum = run_channel(40, frac, 0, frames);
+            int32_t error = (int32_t)(sum * 256) - (40 * 256 + frac) * frames;
+            CHECK((error <= 0) && (error > -256));
+        }
+    }
+}
+
+static void test_channels()
+{
+    /* each channel has its own accumulator */
+    uint8_t acc[3] = { 0 };
+    uint32_t sum[3] = { 0 };
+    uint32_t color = 10 << 16 | 20 << 8 | 30;
+    uint32_t frac = 0x80 << 16 | 0x10 << 8 | 0xf0;
+    for (int i = 0; i < CYCLE; i++) {
+        uint32_t out = rgb_dither(acc, color, frac);
+        sum[0] += (out >> 16) & 0xff;
+        sum[1] += (out >> 8) & 0xff;
+        sum[2] += out & 0xff;
+    }
+    CHECK_EQ(sum[0], 10 * CYCLE + 8);
+    CHECK_EQ(sum[1], 20 * CYCLE + 1);
+    CHECK_EQ(sum[2], 30 * CYCLE + 15);
+}
+
+static void test_edges()
+{
+    /* full scale never wraps around */
+    uint8_t acc[3] = { 0 };
+    for (int i = 0; i < CYCLE; i++) {
+        uint32_t out = rgb_dither(acc, 0xffffff, 0xf0f0f0);
+        CHECK_EQ(out, 0xffffff);
+    }
+
+    /* no fraction, no change, accumulators untouched */
+    memset(acc, 0x55, sizeof(acc));
+    CHECK_EQ(rgb_dither(acc, 0x123456, 0), 0x123456);
+    CHECK_EQ(acc[0], 0x55);
+}
+
+int main()
+{
+    test_average_matches_table();
+    test_dark_colors();
+    test_long_run();
+    test_channels();
+    test_edges();
+    return test_done("rgb_dither");
+}
@@ -0,0 +1,351 @@
+/*
+ * Config Journal Power Loss Tests
+ * WHowe <github.com/whowechina>
+ *
+ * save.c as it is, over a RAM model of the flash. A script of config
+ * changes runs again and again with the power cut at each program or erase
+ * step in turn. The next boot has to come up with the last committed image,
+ * and the first save after it has to survive another boot.
+ *
+ * Every boot is a forked process, as save.c keeps its state in statics.
+ * The flash and the expected images live in shared memory.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "test.h"
+
+#include "save.h"
+#include "hardware/flash.h"
+#include "pico/unique_id.h"
+
+#define MAGIC 0x4a4e5254
+#define REGION_A 400
+#define REGION_B 100
+#define STEPS 300
+
+typedef struct {
+    uint8_t a[REGION_A];
+    uint8_t b[REGION_B];
+} config_image_t;
+
+enum {
+    CUT_NONE, // the interrupted step didn't happen at all
+    CUT_HEAD, // only its first half landed
+    CUT_TAIL, // only its second half landed
+};
+
+static const char *cut_names[] = { "none", "head", "tail" };
+
+static struct {
+    uint8_t flash[PICO_FLASH_SIZE_BYTES];
+    config_image_t committed; // last image that was completely written
+    config_image_t inflight; // being written when the power went
+    int ops; // program and erase steps so far
+    int cut_at; // power goes during this step, 0: never
+    int cut_how;
+    int compacts; // erases ahead of time, outside of a write
+    uint32_t seq; // journal sequence at the end of the script
+} *shared;
+
+uint8_t *flash_model;
+
+static config_image_t *cfg;
+
+/* the rest of the firmware, as far as save.c sees it */
+static uint64_t now;
+uint64_t time_us_64()
+{
+    return now;
+}
+
+static mutex_t lock;
+static bool irq_off;
+
+bool mutex_enter_timeout_us(mutex_t *mtx, uint32_t timeout_us)
+{
+    CHECK(!mtx->owned);
+    mtx->owned = true;
+    return true;
+}
+
+void mutex_exit(mutex_t *mtx)
+{
+    CHECK(mtx->owned);
+    mtx->owned = false;
+}
+
+bool multicore_lockout_victim_is_initialized(unsigned core)
+{
+    return false;
+}
+
+bool multicore_lockout_start_timeout_us(uint64_t timeout_us)
+{
+    return true;
+}
+
+void multicore_lockout_end_blocking()
+{
+}
+
+uint32_t save_and_disable_interrupts()
+{
+    irq_off = true;
+    return 1;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    irq_off = false;
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id)
+{
+    memset(id, 0x5a, sizeof(*id));
+}
+
+static void power_off()
+{
+    if (test_failures) {
+        fflush(stdout); // only failing boots show their log
+    }
+    _exit(test_failures ? 1 : 0);
+}
+
+/* Tells which part of a step lands, [from, to) of count */
+static bool step(size_t count, size_t *from, size_t *to)
+{
+    CHECK(irq_off && lock.owned);
+    *from = 0;
+    *to = count;
+    if (++shared->ops != shared->cut_at) {
+        return false;
+    }
+    if (shared->cut_how == CUT_NONE) {
+        *to = 0;
+    } else if (shared->cut_how == CUT_HEAD) {
+        *to = count / 2;
+    } else {
+        *from = count / 2;
+    }
+    return true;
+}
+
+void flash_range_erase(uint32_t offset, size_t count)
+{
+    CHECK_EQ(offset % FLASH_SECTOR_SIZE, 0);
+    CHECK_EQ(count % FLASH_SECTOR_SIZE, 0);
+    CHECK(offset + count <= PICO_FLASH_SIZE_BYTES);
+
+    size_t from;
+    size_t to;
+    bool cut = step(count, &from, &to);
+    memset(shared->flash + offset + from, 0xff, to - from);
+    if (cut) {
+        power_off();
+    }
+}
+
+void flash_range_program(uint32_t offset, const uint8_t *data, size_t count)
+{
+    CHECK_EQ(offset % FLASH_PAGE_SIZE, 0);
+    CHECK_EQ(count % FLASH_PAGE_SIZE, 0);
+    CHECK(offset + count <= PICO_FLASH_SIZE_BYTES);
+
+    size_t from;
+    size_t to;
+    bool cut = step(count, &from, &to);
+    for (size_t i = from; i < to; i++) {
+        /* NOR flash only clears bits, 0xff pads leave bytes as they are,
+           anything else has to go to erased bytes */
+        CHECK((data[i] == 0xff) || (shared->flash[offset + i] == 0xff));
+        shared->flash[offset + i] &= data[i];
+    }
+    if (cut) {
+        power_off();
+    }
+}
+
+static void fill_defaults(config_image_t *image)
+{
+    for (int i = 0; i < REGION_A; i++) {
+        image->a[i] = i;
+    }
+    for (int i = 0; i < REGION_B; i++) {
+        image->b[i] = 0x80 + i;
+    }
+}
+
+static void loaded()
+{
+}
+
+/* like config_init() and main() do it */
+static void power_on()
+{
+    static config_image_t def;
+    fill_defaults(&def);
+
+    now = 100000000;
+    cfg = (config_image_t *)save_alloc(REGION_A, def.a, loaded);
+    CHECK(save_alloc(REGION_B, def.b, loaded) == cfg->b);
+    save_init(MAGIC, &lock);
+}
+
+static uint32_t random_next(uint32_t *seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+/* small tweaks mostly, so records append, some big ones to fill sectors */
+static void change(uint32_t *seed)
+{
+    uint32_t r = random_next(seed);
+    switch (r % 4) {
+        case 0:
+            cfg->a[r % REGION_A] ^= 0x5a;
+            break;
+        case 1:
+            for (int i = 0; i < 4; i++) {
+                cfg->b[random_next(seed) % REGION_B]++;
+            }
+            break;
+        case 2:
+            cfg->a[r % REGION_A]++;
+            cfg->b[r % REGION_B]--;
+            break;
+        default:
+            for (int i = 0; i < REGION_A; i++) {
+                cfg->a[i] += r;
+            }
+            break;
+    }
+}
+
+static void save_now()
+{
+    shared->inflight = *cfg;
+    uint32_t writes = save_stats()->writes;
+    save_request(true);
+    save_loop();
+    CHECK_EQ(save_stats()->writes, writes + 1);
+    shared->committed = *cfg;
+
+    /* idle for a while, that's when the spare sector gets erased */
+    int ops = shared->ops;
+    now += 1000000;
+    save_loop();
+    if (shared->ops != ops) {
+        shared->compacts++;
+    }
+}
+
+static void run_script()
+{
+    power_on();
+    uint32_t seed = 2463534242;
+    for (int i = 0; i < STEPS; i++) {
+        change(&seed);
+        save_now();
+    }
+    shared->seq = save_stats()->seq;
+}
+
+/* the last committed image, or the one in flight if its bytes all landed */
+static void run_recover()
+{
+    power_on();
+    bool committed = memcmp(cfg, &shared->committed, sizeof(*cfg)) == 0;
+    bool inflight = memcmp(cfg, &shared->inflight, sizeof(*cfg)) == 0;
+    CHECK(committed || ((shared->cut_how != CUT_NONE) && inflight));
+
+    /* a small change, it would be lost if it got appended after a torn tail */
+    cfg->b[0]++;
+    save_now();
+}
+
+static void run_check()
+{
+    power_on();
+    CHECK(memcmp(cfg, &shared->committed, sizeof(*cfg)) == 0);
+}
+
+/* one boot of the board */
+static bool boot(void (*run)())
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        test_failures = 0; // the board's own
+        run();
+        power_off();
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+}
+
+static void reset(int cut_at, int cut_how)
+{
+    memset(shared->flash, 0xff, sizeof(shared->flash));
+    fill_defaults(&shared->committed);
+    shared->inflight = shared->committed;
+    shared->ops = 0;
+    shared->cut_at = cut_at;
+    shared->cut_how = cut_how;
+    shared->compacts = 0;
+}
+
+static void test_script()
+{
+    /* without a power cut, and it has to go around all sectors twice */
+    reset(0, CUT_NONE);
+    CHECK(boot(run_script));
+    CHECK(shared->seq >= 8);
+    CHECK(shared->compacts > 0);
+    CHECK(boot(run_check));
+}
+
+static void test_power_cuts()
+{
+    reset(0, CUT_NONE);
+    boot(run_script);
+    int total = shared->ops;
+
+    for (int cut = 1; cut <= total; cut++) {
+        for (int how = CUT_NONE; how <= CUT_TAIL; how++) {
+            reset(cut, how);
+            bool ok = boot(run_script) && (shared->ops == cut);
+            shared->cut_at = 0;
+            ok = ok && boot(run_recover) && boot(run_check);
+            if (!ok) {
+                printf("power cut at step %d of %d, %s landed\n",
+                       cut, total, cut_names[how]);
+                test_failures++;
+            }
+        }
+    }
+}
+
+int main()
+{
+    static char out[1 << 20];
+    setvbuf(stdout, out, _IOFBF, sizeof(out));
+
+    shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    flash_model = shared->flash;
+
+    test_script();
+    test_power_cuts();
+    return test_done("save_journal");
+}
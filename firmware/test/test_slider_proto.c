@@ -0,0 +1,197 @@
+/*
+ * Slider Protocol Decoder Tests
+ * WHowe <github.com/whowechina>
+ *
+ * Replays slider byte streams as captured on the UART and the host CDC.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "slider_proto.h"
+
+/* report: key 0 = 40, 1 = 19, 2 = 20, 7 = 0xff, 8 = 0xfd, 31 = 200 */
+static const uint8_t report_stream[] = {
+    0xff, 0x01, 0x20, 0x28, 0x13, 0x14, 0x00, 0x00, 0x00, 0x00, 0xfd, 0xfe,
+    0xfd, 0xfc, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0xc8, 0xcd,
+};
+
+/* LED frame: brightness 0x3f, byte n = n * 7, with 0xff, 0xfd at 9, 10 */
+static const uint8_t led_stream[] = {
+    0xff, 0x02, 0x61, 0x3f, 0x00, 0x07, 0x0e, 0x15, 0x1c, 0x23, 0x2a, 0x31,
+    0x38, 0xfd, 0xfe, 0xfd, 0xfc, 0x4d, 0x54, 0x5b, 0x62, 0x69, 0x70, 0x77,
+    0x7e, 0x85, 0x8c, 0x93, 0x9a, 0xa1, 0xa8, 0xaf, 0xb6, 0xbd, 0xc4, 0xcb,
+    0xd2, 0xd9, 0xe0, 0xe7, 0xee, 0xf5, 0xfc, 0x03, 0x0a, 0x11, 0x18, 0x1f,
+    0x26, 0x2d, 0x34, 0x3b, 0x42, 0x49, 0x50, 0x57, 0x5e, 0x65, 0x6c, 0x73,
+    0x7a, 0x81, 0x88, 0x8f, 0x96, 0x9d, 0xa4, 0xab, 0xb2, 0xb9, 0xc0, 0xc7,
+    0xce, 0xd5, 0xdc, 0xe3, 0xea, 0xf1, 0xf8, 0xfd, 0xfe, 0x06, 0x0d, 0x14,
+    0x1b, 0x22, 0x29, 0x30, 0x37, 0x3e, 0x45, 0x4c, 0x53, 0x5a, 0x61, 0x68,
+    0x6f, 0x76, 0x7d, 0x84, 0x8b, 0x92, 0x99, 0x38,
+};
+
+static const uint8_t scan_on_stream[] = { 0xff, 0x03, 0x00, 0xfe };
+
+typedef struct {
+    int frames;
+    int errors;
+    uint8_t cmd[8];
+    uint8_t len[8];
+} replay_t;
+
+static slider_decoder_t dec;
+
+static replay_t replay(const uint8_t *stream, int len)
+{
+    replay_t r = { 0 };
+    for (int i = 0; i < len; i++) {
+        int result = slider_decode(&dec, stream[i]);
+        if (result == SLIDER_DECODE_FRAME) {
+            r.cmd[r.frames % 8] = dec.cmd;
+            r.len[r.frames % 8] = dec.len;
+            r.frames++;
+        } else if (result == SLIDER_DECODE_ERROR) {
+            r.errors++;
+        }
+    }
+    return r;
+}
+
+static void new_decoder()
+{
+    memset(&dec, 0, sizeof(dec));
+    slider_decoder_reset(&dec);
+}
+
+static void test_report()
+{
+    new_decoder();
+    replay_t r = replay(report_stream, sizeof(report_stream));
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(r.errors, 0);
+    CHECK_EQ(dec.cmd, SLIDER_CMD_REPORT);
+    CHECK_EQ(dec.len, SLIDER_KEY_NUM);
+    CHECK_EQ(dec.data[7], 0xff);
+    CHECK_EQ(dec.data[8], 0xfd);
+
+    uint32_t bitmap = slider_touch_bitmap(dec.data, 20);
+    CHECK_EQ(bitmap, (1ul << 0) | (1ul << 2) | (1ul << 7) | (1ul << 8) | (1ul << 31));
+}
+
+static void test_led()
+{
+    uint8_t expect[SLIDER_LED_LEN] = { 0x3f };
+    for (int i = 0; i < SLIDER_LED_LEN - 1; i++) {
+        expect[i + 1] = i * 7;
+    }
+    expect[10] = 0xff;
+    expect[11] = 0xfd;
+
+    new_decoder();
+    replay_t r = replay(led_stream, sizeof(led_stream));
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(dec.cmd, SLIDER_CMD_LED);
+    CHECK_EQ(dec.len, SLIDER_LED_LEN);
+    CHECK(memcmp(dec.data, expect, SLIDER_LED_LEN) == 0);
+}
+
+static void test_mixed_stream()
+{
+    uint8_t stream[512];
+    int len = 0;
+
+    /* line noise before the first sync is ignored */
+    stream[len++] = 0x12;
+    stream[len++] = 0xfd;
+    memcpy(stream + len, scan_on_stream, sizeof(scan_on_stream));
+    len += sizeof(scan_on_stream);
+    memcpy(stream + len, report_stream, sizeof(report_stream));
+    len += sizeof(report_stream);
+    memcpy(stream + len, led_stream, sizeof(led_stream));
+    len += sizeof(led_stream);
+    memcpy(stream + len, report_stream, sizeof(report_stream));
+    len += sizeof(report_stream);
+
+    new_decoder();
+    replay_t r = replay(stream, len);
+    CHECK_EQ(r.frames, 4);
+    CHECK_EQ(r.errors, 0);
+    CHECK_EQ(r.cmd[0], SLIDER_CMD_SCAN_ON);
+    CHECK_EQ(r.cmd[1], SLIDER_CMD_REPORT);
+    CHECK_EQ(r.cmd[2], SLIDER_CMD_LED);
+    CHECK_EQ(r.cmd[3], SLIDER_CMD_REPORT);
+    CHECK_EQ(dec.frames, 4);
+}
+
+static void test_bad_checksum()
+{
+    uint8_t stream[sizeof(report_stream)];
+    memcpy(stream, report_stream, sizeof(stream));
+    stream[3]++;
+
+    new_decoder();
+    replay_t r = replay(stream, sizeof(stream));
+    CHECK_EQ(r.frames, 0);
+    CHECK_EQ(r.errors, 1);
+    CHECK_EQ(dec.errors, 1);
+
+    /* the decoder picks up again at the next frame */
+    r = replay(scan_on_stream, sizeof(scan_on_stream));
+    CHECK_EQ(r.frames, 1);
+}
+
+static void test_broken_frame()
+{
+    /* a report cut short by a new sync, then a complete one */
+    new_decoder();
+    replay_t r = replay(report_stream, 20);
+    CHECK_EQ(r.frames, 0);
+    r = replay(report_stream, sizeof(report_stream));
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(dec.errors, 1);
+    CHECK_EQ(slider_touch_bitmap(dec.data, 20) & 1, 1);
+}
+
+static void test_encode()
+{
+    uint8_t report[SLIDER_KEY_NUM] = { 40, 19, 20 };
+    report[7] = 0xff;
+    report[8] = 0xfd;
+    report[31] = 200;
+
+    uint8_t buf[256];
+    int len = slider_encode(buf, sizeof(buf), SLIDER_CMD_REPORT, report, sizeof(report));
+    CHECK_EQ(len, sizeof(report_stream));
+    CHECK(memcmp(buf, report_stream, sizeof(report_stream)) == 0);
+
+    len = slider_encode(buf, sizeof(buf), SLIDER_CMD_SCAN_ON, NULL, 0);
+    CHECK_EQ(len, sizeof(scan_on_stream));
+    CHECK(memcmp(buf, scan_on_stream, sizeof(scan_on_stream)) == 0);
+
+    /* checksum itself needs escaping */
+    report[0] = 0; // 0xff + 0x01 + 0x01 + 0x00, checksum is 0xff
+    len = slider_encode(buf, sizeof(buf), SLIDER_CMD_REPORT, report, 1);
+    CHECK(len > 0);
+    CHECK_EQ(buf[len - 2], SLIDER_ESCAPE);
+
+    new_decoder();
+    replay_t r = replay(buf, len);
+    CHECK_EQ(r.frames, 1);
+    CHECK_EQ(dec.data[0], 0);
+
+    CHECK_EQ(slider_encode(buf, 10, SLIDER_CMD_REPORT, report, 32), 0);
+}
+
+int main()
+{
+    test_report();
+    test_led();
+    test_mixed_stream();
+    test_bad_checksum();
+    test_broken_frame();
+    test_encode();
+    return test_done("slider_proto");
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""
+Chu Arcade Trace Dump
+WHowe <github.com/whowechina>
+
+Reads the per core event rings of a CHU_TRACE firmware build over the
+vendor port and writes a Chrome/Perfetto trace, open it in
+ui.perfetto.dev or chrome://tracing.
+
+  chu_trace.py <out.json> [--clear]
+"""
+
+import json
+import struct
+import sys
+
+from chu_vendor import ChuVendor
+
+CMD_TRACE_CTRL = 0x40
+CMD_TRACE_READ = 0x41
+
+TRACE_RESUME = 0
+TRACE_PAUSE = 1
+TRACE_CLEAR = 2
+
+# Keep in sync with src/trace.h
+NAMES = ["air", "hid", "flash_erase", "flash_program", "pn532",
+         "led_frame", "slider_frame", "profile"]
+PHASES = ["B", "E", "i"]
+
+EVENT = struct.Struct("<IBBH")
+
+
+def read_core(dev, core):
+    events = []
+    total = None
+    while total is None or len(events) < total:
+        data = dev.request(CMD_TRACE_READ, struct.pack("<BH", core, len(events)))
+        total = struct.unpack_from("<H", data)[0]
+        chunk = data[2:]
+        if not chunk:
+            break
+        events += [EVENT.unpack_from(chunk, i)
+                   for i in range(0, len(chunk), EVENT.size)]
+    return events
+
+
+def to_chrome(cores):
+    # 32 bit us timestamps, unwrapped back from the newest event
+    lasts = [events[-1][0] for events in cores if events]
+    newest = lasts[0] if lasts else 0
+    for t in lasts:
+        if (t - newest) & 0xffffffff < 0x80000000:
+            newest = t
+    rel = lambda t: -((newest - t) & 0xffffffff)
+    start = min((rel(ev[0]) for events in cores for ev in events), default=0)
+
+    out = []
+    for core, events in enumerate(cores):
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": core,
+                    "args": {"name": f"core{core}"}})
+        for time, ident, kind, arg in events:
+            name = NAMES[ident] if ident < len(NAMES) else f"event{ident}"
+            ev = {"name": name, "ph": PHASES[kind], "ts": rel(time) - start,
+                  "pid": 0, "tid": core, "args": {"arg": arg}}
+            if kind == 2:
+                ev["s"] = "t"
+            out.append(ev)
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__)
+        return 1
+
+    dev = ChuVendor()
+    dev.request(CMD_TRACE_CTRL, bytes([TRACE_PAUSE]))
+    try:
+        cores = [read_core(dev, 0), read_core(dev, 1)]
+        if "--clear" in argv[2:]:
+            dev.request(CMD_TRACE_CTRL, bytes([TRACE_CLEAR]))
+    finally:
+        dev.request(CMD_TRACE_CTRL, bytes([TRACE_RESUME]))
+
+    with open(argv[1], "w") as f:
+        json.dump(to_chrome(cores), f)
+    print(f"core0: {len(cores[0])} events, core1: {len(cores[1])} events")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
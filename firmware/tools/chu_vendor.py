@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+"""
+Chu Arcade Vendor Bulk Interface Reference Client
+WHowe <github.com/whowechina>
+
+Needs pyusb (pip install pyusb). On Windows, bind WinUSB to the
+"Chu Arcade Vendor Port" interface with Zadig first.
+
+  chu_vendor.py ping
+  chu_vendor.py cfg-read <offset> <size>
+  chu_vendor.py cfg-write <offset> <hex bytes>
+  chu_vendor.py cfg-export <file>
+  chu_vendor.py cfg-import <file>
+  chu_vendor.py stream <interval_ms> [count]
+  chu_vendor.py led <index> <rrggbb> [rrggbb ...]
+  chu_vendor.py led-anim <fps> <seconds>
+"""
+
+import colorsys
+import struct
+import sys
+import time
+
+import usb.core
+import usb.util
+
+VID = 0x0ca3
+PID = 0x0021
+
+SYNC = 0xc5
+REPLY = 0x80
+
+CMD_PING = 0x01
+CMD_CFG_READ = 0x10
+CMD_CFG_WRITE = 0x11
+CMD_CFG_EXPORT = 0x12
+CMD_CFG_IMPORT = 0x13
+CMD_SENSOR_STREAM = 0x20
+CMD_SENSOR_DATA = 0x21 | REPLY
+CMD_LED_FRAME = 0x30
+CMD_LED_STREAM = 0x31
+
+LED_COMMIT = 0x01
+LED_QUIET = 0x02
+LED_NUM = 47
+
+STATUS = ["ok", "checksum error", "unknown command", "bad parameter"]
+
+
+class ChuVendor:
+    def __init__(self):
+        self.dev = usb.core.find(idVendor=VID, idProduct=PID)
+        if self.dev is None:
+            raise IOError("Chu Arcade not found")
+
+        cfg = self.dev.get_active_configuration()
+        itf = usb.util.find_descriptor(cfg, bInterfaceClass=0xff)
+        if itf is None:
+            raise IOError("Vendor interface not found")
+
+        out_match = lambda e: usb.util.endpoint_direction(e.bEndpointAddress) \
+                              == usb.util.ENDPOINT_OUT
+        in_match = lambda e: usb.util.endpoint_direction(e.bEndpointAddress) \
+                             == usb.util.ENDPOINT_IN
+        self.ep_out = usb.util.find_descriptor(itf, custom_match=out_match)
+        self.ep_in = usb.util.find_descriptor(itf, custom_match=in_match)
+        self.rx = bytearray()
+
+    def send(self, cmd, payload=b""):
+        body = struct.pack("<BH", cmd, len(payload)) + bytes(payload)
+        self.ep_out.write(bytes([SYNC]) + body + bytes([sum(body) & 0xff]))
+
+    def recv(self, timeout=1000):
+        while True:
+            frame = self._parse()
+            if frame:
+                return frame
+            self.rx += bytes(self.ep_in.read(512, timeout))
+
+    def _parse(self):
+        while self.rx and self.rx[0] != SYNC:
+            self.rx.pop(0)
+        if len(self.rx) < 4:
+            return None
+        cmd, length = struct.unpack_from("<BH", self.rx, 1)
+        if len(self.rx) < length + 5:
+            return None
+        body = self.rx[1:length + 4]
+        checksum = self.rx[length + 4]
+        del self.rx[:length + 5]
+        if sum(body) & 0xff != checksum:
+            return self._parse()
+        return cmd, bytes(body[3:])
+
+    def request(self, cmd, payload=b""):
+        self.send(cmd, payload)
+        while True:
+            rcmd, data = self.recv()
+            if rcmd == cmd | REPLY:
+                if data[0] != 0:
+                    raise IOError(STATUS[data[0]] if data[0] < len(STATUS)
+                                  else f"status {data[0]}")
+                return data[1:]
+
+    def ping(self):
+        return struct.unpack("<Q", self.request(CMD_PING))[0]
+
+    def cfg_read(self, offset, size):
+        return self.request(CMD_CFG_READ, struct.pack("<HH", offset, size))
+
+    def cfg_write(self, offset, data):
+        self.request(CMD_CFG_WRITE, struct.pack("<H", offset) + data)
+
+    def cfg_export(self):
+        return self.request(CMD_CFG_EXPORT)
+
+    def cfg_import(self, snapshot):
+        self.request(CMD_CFG_IMPORT, snapshot)
+
+    def stream(self, interval_ms):
+        self.request(CMD_SENSOR_STREAM, bytes([interval_ms]))
+
+    def led(self, index, colors):
+        data = bytearray([index])
+        for c in colors:
+            data += bytes([(c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff])
+        self.request(CMD_LED_FRAME, data)
+
+    def led_stream(self, colors, index=0):
+        data = bytearray([LED_COMMIT | LED_QUIET, index])
+        for c in colors:
+            data += bytes([(c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff])
+        self.send(CMD_LED_STREAM, data)
+
+
+def rainbow(phase):
+    colors = []
+    for i in range(LED_NUM):
+        r, g, b = colorsys.hsv_to_rgb((phase + i / LED_NUM) % 1.0, 1, 1)
+        colors.append(int(r * 255) << 16 | int(g * 255) << 8 | int(b * 255))
+    return colors
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__)
+        return 1
+
+    dev = ChuVendor()
+    cmd = argv[1]
+
+    if cmd == "ping":
+        print(f"SN: {dev.ping():016x}")
+    elif cmd == "cfg-read":
+        print(dev.cfg_read(int(argv[2], 0), int(argv[3], 0)).hex(" "))
+    elif cmd == "cfg-write":
+        dev.cfg_write(int(argv[2], 0), bytes.fromhex("".join(argv[3:])))
+    elif cmd == "cfg-export":
+        snapshot = dev.cfg_export()
+        with open(argv[2], "wb") as f:
+            f.write(snapshot)
+        magic, version, size = struct.unpack_from("<IHH", snapshot)
+        print(f"Schema {magic:08x} v{version}, {size} bytes saved")
+    elif cmd == "cfg-import":
+        with open(argv[2], "rb") as f:
+            dev.cfg_import(f.read())
+        print("Imported, saved when the controller is idle")
+    elif cmd == "stream":
+        count = int(argv[3]) if len(argv) > 3 else 100
+        dev.stream(int(argv[2]))
+        while count > 0:
+            rcmd, data = dev.recv()
+            if rcmd != CMD_SENSOR_DATA:
+                continue
+            t, air, buttons, num = struct.unpack_from("<IBBB", data)
+            tof = struct.unpack_from(f"<{num}H", data, 7)
+            print(f"{t:10d} air:{air:06b} btn:{buttons:03b} tof:",
+                  " ".join(f"{d // 10:4d}" for d in tof))
+            count -= 1
+        dev.stream(0)
+    elif cmd == "led":
+        dev.led(int(argv[2], 0), [int(c, 16) for c in argv[3:]])
+    elif cmd == "led-anim":
+        fps = int(argv[2])
+        frames = fps * int(argv[3])
+        start = time.monotonic()
+        for n in range(frames):
+            dev.led_stream(rainbow(n / fps / 4))
+            delay = start + (n + 1) / fps - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        elapsed = time.monotonic() - start
+        print(f"{frames} frames in {elapsed:.2f}s, {frames / elapsed:.1f} fps")
+    else:
+        print(__doc__)
+        return 1
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))